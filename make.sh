@@ -1,2 +1,11 @@
-g++ ./src/*.cc -o $1 -std=c++11 -Wall -Wextra -pedantic -Wshadow -DNDEBUG \
-	-O3 -msse4.2 -fno-rtti -flto -s
+# usage: ./make.sh <output> [pext]
+# pext: use BMI2 (pext) for slider attacks, instead of magic multiplications (Intel Haswell or later,
+# AMD Zen 3 or later: it is very slow on older AMD processors, that emulate pext in microcode)
+if [ "$2" = "pext" ]; then F="-DUSE_PEXT -mbmi2"; fi
+
+# the lookup tables of bitboard.cc are generated first, in a temporary directory (see gen/tables.cc)
+T=$(mktemp -d)
+g++ ./src/gen/tables.cc -o $T/gen -std=c++11 -O2 && $T/gen > $T/tables.inc &&
+g++ ./src/*.cc -o $1 -I$T -std=c++11 -Wall -Wextra -pedantic -Wshadow -DNDEBUG \
+	-O3 -msse4.2 $F -fno-rtti -fno-exceptions -pthread -flto -s
+rm -r $T
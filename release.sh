@@ -1,15 +1,20 @@
 W="-Wall -Wextra -pedantic -Wshadow"
 
-echo "building linux compiles"
-g++ ./src/*.cc -o ./bin/${1}_sse2   -DNDEBUG -std=c++11 -O3 -msse2   -fno-rtti -flto -s $W
-g++ ./src/*.cc -o ./bin/${1}_sse4.2 -DNDEBUG -std=c++11 -O3 -msse4.2 -fno-rtti -flto -s $W
+echo "generating lookup tables"
+T=$(mktemp -d)
+g++ ./src/gen/tables.cc -o $T/gen -std=c++11 -O2 && $T/gen > $T/tables.inc || exit 1
+W="$W -I$T"
 
-echo "building windows compiles"
-x86_64-w64-mingw32-g++ ./src/*.cc -o ./bin/${1}_sse2.exe   -DNDEBUG -std=c++0x -O3 -msse2   -fno-rtti -s -static -flto $W
-x86_64-w64-mingw32-g++ ./src/*.cc -o ./bin/${1}_sse4.2.exe -DNDEBUG -std=c++0x -O3 -msse4.2 -fno-rtti -s -static -flto $W
+# one generic binary per OS: popcnt and pext are detected at runtime (see bb::init())
+echo "building linux compile"
+g++ ./src/*.cc -o ./bin/${1} -DNDEBUG -std=c++11 -O3 -msse2 -fno-rtti -fno-exceptions -pthread -flto -s $W
+
+echo "building windows compile"
+x86_64-w64-mingw32-g++ ./src/*.cc -o ./bin/${1}.exe -DNDEBUG -std=c++0x -O3 -msse2 -fno-rtti -fno-exceptions -pthread -s -static -flto $W
 
 echo "make tarball and cleanup"
 cd ./bin
-tar czf ./${1}.tar.gz ./${1}_sse*
-rm ./${1}_sse*
+tar czf ./${1}.tar.gz ./${1} ./${1}.exe
+rm ./${1} ./${1}.exe
 cd ..
+rm -r $T
@@ -0,0 +1,647 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * Credits: the original KPK bitbase generation code was based on Stockfish.
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include "bitbase.h"
+#include "uci.h"
+
+namespace {
+
+const int MAX_PIECES = 4;	// Kings included
+
+// Bitbases are cached in CacheFile, in the first of CacheDirs where it can be read or written: next
+// to the executable, then in the user's cache directory, then in the current one (see init()).
+// Change CacheMagic whenever the list of tables, or the index encoding, changes: this invalidates
+// the cache files written by older versions.
+const char *CacheFile = "discocheck.bb";
+std::vector<std::string> CacheDirs;
+const uint32_t CacheMagic = 0xDCBB0002;
+
+// Each table is built for one attacker (the strong side, White in the tables, or the weak side when
+// it has pieces): WIN means the attacker wins, and DRAW means it doesn't
+enum { ILLEGAL, UNKNOWN, DRAW, WIN };
+
+// When there is no cache file, the small tables are generated right away, and the others by the
+// Builder thread, while the engine starts and plays without them. ReadyCnt is the number of tables
+// (in order) that can be probed. Abort stops the generation.
+std::atomic<size_t> ReadyCnt(0);
+std::atomic<bool> Abort(false);
+std::thread Builder;
+
+/* Symmetries: the White King is mapped to the A1-D1-D4 triangle (pawnless tables) or to files A..D
+ * (tables with pawns). KingIdx[has_pawns][sq] is its index, KingSq[][] the reverse mapping. */
+int KingIdx[2][NB_SQUARE], KingSq[2][32];
+const int KingCnt[2] = { 10, 32 };
+
+int transform(int sq, int t)
+{
+	if (t & 1)
+		sq = file_mirror(sq);
+	if (t & 2)
+		sq = rank_mirror(sq);
+	if (t & 4)
+		sq = ((sq >> 3) | (sq << 3)) & 63;	// A1-H8 diagonal
+	return sq;
+}
+
+struct Position {
+	int n, stm;
+	int piece[MAX_PIECES], color[MAX_PIECES], sq[MAX_PIECES];
+
+	Bitboard occ(int c) const;
+	Bitboard occ() const { return occ(WHITE) | occ(BLACK); }
+	int king_pos(int c) const;
+	Key mat_key() const;
+	bool attacked(int s, int by) const;
+	bool in_check() const { return attacked(king_pos(stm), opp_color(stm)); }
+	bool legal() const;
+	void remove(int i);
+};
+
+Bitboard Position::occ(int c) const
+{
+	Bitboard b = 0;
+	for (int i = 0; i < n; ++i)
+		if (color[i] == c)
+			bb::set_bit(&b, sq[i]);
+	return b;
+}
+
+int Position::king_pos(int c) const
+{
+	for (int i = 0; i < n; ++i)
+		if (piece[i] == KING && color[i] == c)
+			return sq[i];
+
+	assert(false);
+	return NO_SQUARE;
+}
+
+Key Position::mat_key() const
+{
+	Key key = 0;
+	for (int i = 0; i < n; ++i)
+		key += 1ULL << (8 * piece[i] + 4 * color[i]);
+	return key;
+}
+
+bool Position::attacked(int s, int by) const
+{
+	const Bitboard o = occ();
+	for (int i = 0; i < n; ++i)
+		if (color[i] == by && bb::test_bit(piece[i] == PAWN ? bb::pattacks(by, sq[i])
+			: bb::piece_attack(piece[i], sq[i], o), s))
+			return true;
+	return false;
+}
+
+bool Position::legal() const
+{
+	Bitboard o = 0;
+	for (int i = 0; i < n; ++i) {
+		if (bb::test_bit(o, sq[i]) || (piece[i] == PAWN && (rank(sq[i]) == RANK_1 || rank(sq[i]) == RANK_8)))
+			return false;
+		bb::set_bit(&o, sq[i]);
+	}
+
+	// the side that just moved cannot be in check (this also excludes adjacent Kings)
+	return !attacked(king_pos(opp_color(stm)), stm);
+}
+
+void Position::remove(int i)
+// remove piece i (captured), preserving the order of the others
+{
+	for (--n; i < n; ++i) {
+		piece[i] = piece[i + 1];
+		color[i] = color[i + 1];
+		sq[i] = sq[i + 1];
+	}
+}
+
+template <typename F>
+void gen_moves(const Position& p, F fn)
+/* Calls fn(q, conversion) for every legal move of p, q being the resulting position. Captures and
+ * promotions are conversions: q then belongs to another bitbase (or is a material draw). */
+{
+	const int us = p.stm, them = opp_color(us);
+	const Bitboard occ = p.occ(), ours = p.occ(us), theirs = p.occ(them);
+
+	for (int i = 0; i < p.n; ++i) {
+		if (p.color[i] != us)
+			continue;
+
+		Bitboard tss;
+		if (p.piece[i] == PAWN) {
+			tss = bb::pattacks(us, p.sq[i]) & theirs;
+			const int to = bb::pawn_push(us, p.sq[i]);
+			if (!bb::test_bit(occ, to)) {
+				bb::set_bit(&tss, to);
+				if (rank(p.sq[i]) == (us ? RANK_7 : RANK_2) && !bb::test_bit(occ, bb::pawn_push(us, to)))
+					bb::set_bit(&tss, bb::pawn_push(us, to));
+			}
+		} else
+			tss = bb::piece_attack(p.piece[i], p.sq[i], occ) & ~ours;
+
+		while (tss) {
+			const int to = bb::pop_lsb(&tss);
+			Position q = p;
+			q.stm = them;
+			q.sq[i] = to;
+
+			int mover = i;
+			const bool capture = bb::test_bit(theirs, to);
+			if (capture)
+				for (int j = 0; j < p.n; ++j)
+					if (j != i && p.sq[j] == to) {
+						q.remove(j);
+						mover -= j < i;
+						break;
+					}
+
+			if (q.attacked(q.king_pos(us), them))
+				continue;
+
+			if (p.piece[i] == PAWN && (rank(to) == RANK_1 || rank(to) == RANK_8))
+				for (int prom = KNIGHT; prom <= QUEEN; ++prom) {
+					q.piece[mover] = prom;
+					fn(q, true);
+				}
+			else
+				fn(q, capture);
+		}
+	}
+}
+
+template <typename F>
+void gen_unmoves(const Position& p, F fn)
+/* Calls fn(q) for every position q that reaches p by a quiet move (neither a capture, nor a
+ * promotion). q may be illegal. */
+{
+	const int us = opp_color(p.stm);	// the side that just moved
+	const Bitboard occ = p.occ();
+
+	for (int i = 0; i < p.n; ++i) {
+		if (p.color[i] != us)
+			continue;
+
+		Bitboard fss = 0;
+		if (p.piece[i] == PAWN) {
+			const int r = us ? RANK_8 - rank(p.sq[i]) : rank(p.sq[i]);	// relative rank
+			const int back = us ? p.sq[i] + 8 : p.sq[i] - 8;
+			if (r >= RANK_3 && !bb::test_bit(occ, back)) {
+				bb::set_bit(&fss, back);
+				const int back2 = us ? back + 8 : back - 8;
+				if (r == RANK_4 && !bb::test_bit(occ, back2))
+					bb::set_bit(&fss, back2);
+			}
+		} else
+			fss = bb::piece_attack(p.piece[i], p.sq[i], occ) & ~occ;
+
+		while (fss) {
+			Position q = p;
+			q.stm = us;
+			q.sq[i] = bb::pop_lsb(&fss);
+			fn(q);
+		}
+	}
+}
+
+int thread_count() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+template <typename F>
+void parallel(F fn)
+// Calls fn(i, threads) for i = 0..threads-1, each on its own thread
+{
+	const int threads = thread_count();
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; ++i)
+		workers.push_back(std::thread(fn, i, threads));
+	for (auto& t : workers)
+		t.join();
+}
+
+class Table {
+public:
+	explicit Table(const std::string& code);
+	void build(int att);
+	bool probe(const Position& p, int att) const;
+
+	Key key, key2;		// material key with the strong side as White / Black
+	Position base;		// pieces and colors, in table order: White King, Black King, then the others
+	bool has_pawns;
+	bool weak_pieces;	// does Black have pieces (and possibly wins)?
+	size_t size;
+	std::vector<uint64_t> bits[NB_COLOR];	// wins of each attacker (empty if it can never win)
+
+private:
+	typedef std::vector<std::atomic<uint8_t>> Results;
+
+	size_t encode(const Position& p) const;
+	Position decode(size_t idx) const;
+	uint8_t rules(size_t idx, int att) const;
+	bool all_moves_win(const Position& p, const Results& res) const;
+};
+
+// Tables are built in this order: each one can only convert into the previous ones
+std::vector<Table> Tables;
+
+Table::Table(const std::string& code): has_pawns(false), weak_pieces(false)
+{
+	base.n = 2;
+	base.stm = WHITE;
+	base.piece[0] = base.piece[1] = KING;
+	base.color[0] = WHITE;
+	base.color[1] = BLACK;
+
+	int color = WHITE;
+	for (char c : code) {
+		const int piece = board::PieceLabel[WHITE].find(c);
+		if (c == 'v')
+			color = BLACK;
+		else if (piece != KING) {
+			assert(base.n < MAX_PIECES);
+			base.piece[base.n] = piece;
+			base.color[base.n++] = color;
+			has_pawns |= piece == PAWN;
+			weak_pieces |= color == BLACK;
+		}
+	}
+
+	key = base.mat_key();
+	key2 = 0;
+	for (int i = 0; i < base.n; ++i)
+		key2 += 1ULL << (8 * base.piece[i] + 4 * opp_color(base.color[i]));
+
+	size = 2 * KingCnt[has_pawns];
+	for (int i = 1; i < base.n; ++i)
+		size *= NB_SQUARE;
+}
+
+size_t Table::encode(const Position& p) const
+/* Applies the symmetry that maps the White King into its canonical area. For pawnless tables, when
+ * the King is on the A1-H8 diagonal, the first piece off the diagonal must be below it: this way,
+ * all symmetric positions have the same index. */
+{
+	int t = file(p.sq[0]) > FILE_D;
+	if (!has_pawns) {
+		t |= (rank(p.sq[0]) > RANK_4) << 1;
+		for (int i = 0; i < p.n; ++i) {
+			const int sq = transform(p.sq[i], t);
+			if (rank(sq) != file(sq)) {
+				t |= (rank(sq) > file(sq)) << 2;
+				break;
+			}
+		}
+	}
+
+	size_t idx = KingIdx[has_pawns][transform(p.sq[0], t)];
+	for (int i = 1; i < p.n; ++i)
+		idx = idx * NB_SQUARE + transform(p.sq[i], t);
+
+	return idx * 2 + p.stm;
+}
+
+Position Table::decode(size_t idx) const
+{
+	Position p = base;
+	p.stm = idx & 1;
+	idx >>= 1;
+
+	for (int i = p.n - 1; i > 0; --i) {
+		p.sq[i] = idx & 63;
+		idx >>= 6;
+	}
+	p.sq[0] = KingSq[has_pawns][idx];
+
+	return p;
+}
+
+bool Table::probe(const Position& p, int att) const
+{
+	if (bits[att].empty())
+		return false;
+
+	const size_t idx = encode(p);
+	return bb::test_bit(bits[att][idx / 64], idx % 64);
+}
+
+int resolve(const Position& p, int att)
+/* Result of a position reached by a conversion, for the attacker att. Its material is either in a
+ * previously built table, or it is a draw by insufficient material. */
+{
+	const Key k = p.mat_key();
+	for (const Table& t : Tables)
+		if (!t.bits[WHITE].empty() && (k == t.key || k == t.key2)) {
+			// reorder the pieces as in the table. When Black is the strong side, swap the colors
+			// and flip the board.
+			const int flip = k != t.key;
+			Position q = t.base;
+			q.stm = p.stm ^ flip;
+			for (int i = 0; i < q.n; ++i)
+				for (int j = 0; j < p.n; ++j)
+					if (p.piece[j] == q.piece[i] && (p.color[j] ^ flip) == q.color[i])
+						q.sq[i] = flip ? rank_mirror(p.sq[j]) : p.sq[j];
+
+			return t.probe(q, att ^ flip) ? WIN : DRAW;
+		}
+
+	// Insufficient material: only Kings, or King and minor piece vs King
+	assert(p.n <= 3 && (p.n == 2 || p.piece[2] == KNIGHT || p.piece[2] == BISHOP));
+	return DRAW;
+}
+
+uint8_t Table::rules(size_t idx, int att) const
+/* Static classification: illegal positions (including the non canonical indexes), mates and
+ * stalemates, and conversions. The attacker wins if one conversion wins, the defender draws if one
+ * conversion doesn't lose. */
+{
+	const Position p = decode(idx);
+	if (!p.legal() || encode(p) != idx)
+		return ILLEGAL;
+
+	int moves = 0;
+	uint8_t r = UNKNOWN;
+	gen_moves(p, [&](const Position& q, bool conversion) {
+		++moves;
+		if (conversion && r == UNKNOWN) {
+			const int v = resolve(q, att);
+			if (p.stm == att && v == WIN)
+				r = WIN;
+			else if (p.stm != att && v != WIN)
+				r = DRAW;
+		}
+	});
+
+	if (!moves)
+		return p.stm != att && p.in_check() ? WIN : DRAW;
+
+	return r;
+}
+
+bool Table::all_moves_win(const Position& p, const Results& res) const
+/* Defender to move: are all the moves lost? Conversions are lost, otherwise rules() would have said
+ * DRAW. */
+{
+	bool all = true;
+	gen_moves(p, [&](const Position& q, bool conversion) {
+		if (!conversion && res[encode(q)] != WIN)
+			all = false;
+	});
+	return all;
+}
+
+void Table::build(int att)
+/* Retrograde analysis, for the wins of att. The static pass (rules) is independent for each
+ * position. Then wins are propagated backwards, one generation at a time: unmoving the side that
+ * just moved from each new win, an attacker predecessor wins, and a defender one is rechecked. Both
+ * are split among threads. A defender that misses a win found concurrently is rechecked at the next
+ * generation, from that win. What remains unknown at the end is a draw (the attacker can't force a
+ * conversion, nor a mate). */
+{
+	Results res(size);
+
+	parallel([&](int i, int threads) {
+		const size_t first = size * i / threads, last = size * (i + 1) / threads;
+		for (size_t idx = first; idx < last && !Abort; ++idx)
+			res[idx] = rules(idx, att);
+	});
+
+	std::vector<size_t> wins;
+	for (size_t idx = 0; idx < size; ++idx)
+		if (res[idx] == WIN)
+			wins.push_back(idx);
+
+	while (!wins.empty() && !Abort) {
+		std::vector<std::vector<size_t>> next(thread_count());
+
+		parallel([&](int i, int threads) {
+			const size_t first = wins.size() * i / threads, last = wins.size() * (i + 1) / threads;
+			for (size_t w = first; w < last && !Abort; ++w)
+				gen_unmoves(decode(wins[w]), [&](const Position& q) {
+					const size_t idx = encode(q);
+					uint8_t unknown = UNKNOWN;
+					if (res[idx] == UNKNOWN && (q.stm == att || all_moves_win(q, res))
+						&& res[idx].compare_exchange_strong(unknown, WIN))
+						next[i].push_back(idx);
+				});
+		});
+
+		wins.clear();
+		for (auto& v : next)
+			wins.insert(wins.end(), v.begin(), v.end());
+	}
+
+	bits[att].assign((size + 63) / 64, 0);
+	for (size_t idx = 0; idx < size; ++idx)
+		if (res[idx] == WIN)
+			bb::set_bit(&bits[att][idx / 64], idx % 64);
+}
+
+uint64_t checksum()
+{
+	uint64_t h = 0;
+	for (const Table& t : Tables)
+		for (int att = WHITE; att <= BLACK; ++att)
+			for (uint64_t w : t.bits[att])
+				h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+	return h;
+}
+
+bool load_cache(const std::string& file)
+{
+	std::ifstream f(file, std::ios::binary);
+	uint32_t magic;
+	if (!f.read((char *)&magic, sizeof(magic)) || magic != CacheMagic)
+		return false;
+
+	for (Table& t : Tables)
+		for (int att = WHITE; att <= t.weak_pieces; ++att) {
+			t.bits[att].resize((t.size + 63) / 64);
+			if (!f.read((char *)&t.bits[att][0], t.bits[att].size() * sizeof(uint64_t)))
+				return false;
+		}
+
+	uint64_t h;
+	return f.read((char *)&h, sizeof(h)) && h == checksum();
+}
+
+bool load_cache()
+{
+	for (const std::string& dir : CacheDirs)
+		if (load_cache(dir + CacheFile))
+			return true;
+	return false;
+}
+
+bool save_cache(const std::string& file)
+/* Several engine processes can be generating the bitbases at the same time, so each one writes to its
+ * own temporary file, and then renames it, which replaces the cache file atomically (POSIX). */
+{
+	const std::string tmp = file + '.'
+		+ std::to_string(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+	{
+		std::ofstream f(tmp, std::ios::binary);
+		const uint64_t h = checksum();
+		f.write((const char *)&CacheMagic, sizeof(CacheMagic));
+		for (const Table& t : Tables)
+			for (int att = WHITE; att <= t.weak_pieces; ++att)
+				f.write((const char *)&t.bits[att][0], t.bits[att].size() * sizeof(uint64_t));
+		f.write((const char *)&h, sizeof(h));
+		if (!f) {
+			std::remove(tmp.c_str());
+			return false;
+		}
+	}
+	if (std::rename(tmp.c_str(), file.c_str())) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+void save_cache()
+/* Saves in the first writable directory. Called by the Builder thread, so the engine can be talking to
+ * the GUI: failures are reported as info strings. */
+{
+	for (const std::string& dir : CacheDirs) {
+		if (save_cache(dir + CacheFile))
+			return;
+		std::lock_guard<std::mutex> lock(uci::IoMutex);
+		std::cout << "info string cannot write the bitbase cache in "
+			<< (dir.empty() ? "the current directory" : dir) << std::endl;
+	}
+}
+
+}	// namespace
+
+namespace bitbase {
+
+void init(const std::string& dir)
+{
+	for (int has_pawns = 0; has_pawns <= 1; ++has_pawns) {
+		int idx = 0;
+		for (int sq = A1; sq <= H8; ++sq)
+			if (has_pawns ? file(sq) <= FILE_D
+				: file(sq) <= FILE_D && rank(sq) <= file(sq)) {
+				KingIdx[has_pawns][sq] = idx;
+				KingSq[has_pawns][idx++] = sq;
+			}
+		assert(idx == KingCnt[has_pawns]);
+	}
+
+	Tables.clear();
+	for (const char *code : { "KQvK", "KRvK", "KPvK", "KRvKB", "KRvKN" })
+		Tables.push_back(Table(code));
+
+	// the user's cache directory is $XDG_CACHE_HOME, or ~/.cache by default
+	const char *xdg = std::getenv("XDG_CACHE_HOME"), *home = std::getenv("HOME");
+	CacheDirs.clear();
+	for (const std::string& d : { dir, xdg && *xdg ? std::string(xdg) + '/'
+			: home && *home ? std::string(home) + "/.cache/" : dir, std::string() })
+		if (std::find(CacheDirs.begin(), CacheDirs.end(), d) == CacheDirs.end())
+			CacheDirs.push_back(d);
+
+	if (load_cache()) {
+		ReadyCnt = Tables.size();
+		return;
+	}
+
+	for (Table& t : Tables)
+		for (auto& b : t.bits)
+			b.clear();
+
+	auto build = [](size_t i) {
+		for (int att = WHITE; att <= Tables[i].weak_pieces; ++att)
+			Tables[i].build(att);
+		ReadyCnt = i + 1;
+	};
+
+	// 3 piece tables take a few ms: KPK, KQK and KRK are never missing
+	size_t i = 0;
+	for (; i < Tables.size() && Tables[i].base.n < MAX_PIECES; ++i)
+		build(i);
+
+	Builder = std::thread([build, i]() {
+		for (size_t j = i; j < Tables.size() && !Abort; ++j)
+			build(j);
+		if (!Abort)
+			save_cache();
+	});
+}
+
+bool ready()
+{
+	return ReadyCnt == Tables.size();
+}
+
+void wait()
+{
+	if (Builder.joinable())
+		Builder.join();
+}
+
+void stop()
+{
+	Abort = true;
+	wait();
+}
+
+bool has(Key mat_key)
+{
+	for (const Table& t : Tables)
+		if (mat_key == t.key || mat_key == t.key2)
+			return true;
+	return false;
+}
+
+bool probe(const board::Board& B, int *winner)
+{
+	const Key k = B.st().mat_key;
+	const size_t ready_cnt = ReadyCnt;
+	for (size_t t = 0; t < ready_cnt; ++t) {
+		const Table& table = Tables[t];
+		if (k != table.key && k != table.key2)
+			continue;
+		if (B.st().crights)
+			return false;
+
+		// Black is the strong side: flip the board
+		const bool flip = k != table.key;
+		Position p = table.base;
+		p.stm = B.get_turn() ^ flip;
+		for (int i = 0; i < p.n; ++i) {
+			const Bitboard b = B.get_pieces(p.color[i] ^ flip, p.piece[i]);
+			assert(b && !bb::several_bits(b));
+			p.sq[i] = flip ? rank_mirror(bb::lsb(b)) : bb::lsb(b);
+		}
+
+		*winner = table.probe(p, WHITE) ? WHITE ^ flip
+			: table.probe(p, BLACK) ? BLACK ^ flip
+			: NO_COLOR;
+		return true;
+	}
+
+	return false;
+}
+
+}	// namespace bitbase
@@ -0,0 +1,38 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "board.h"
+
+namespace bitbase {
+
+/* Loads the bitbases from the cache file, in dir (empty, or with a trailing separator), or in the
+ * fallback directories where it is written when dir is not writable (see bitbase.cc). Otherwise,
+ * the 3 piece ones are generated right away, and the others (and the cache file) by a background
+ * thread: probe() fails for them until ready() is true. wait() waits for them, stop() aborts the
+ * generation (it must be called before exiting). */
+extern void init(const std::string& dir);
+extern bool ready();
+extern void wait();
+extern void stop();
+
+// Is there a bitbase for this material (ready or not)?
+extern bool has(Key mat_key);
+
+/* Returns false if there is no bitbase for the material of B. Otherwise, *winner is the color that
+ * wins, or NO_COLOR for a draw. The weak side (the one with less material) can win too, when it has
+ * pieces: eg. KRKB has a few positions where the Bishop side mates. */
+extern bool probe(const board::Board& B, int *winner);
+
+}	// namespace bitbase
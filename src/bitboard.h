@@ -13,6 +13,7 @@
  * see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <string>
 #include "types.h"
 
 namespace bb {
@@ -28,9 +29,9 @@ extern Bitboard half_board(int c);
 const Bitboard WhiteSquares = 0x55AA55AA55AA55AAULL;
 const Bitboard BlackSquares = 0xAA55AA55AA55AA55ULL;
 
-// Initialize: bitboards, magics
+// Detects the CPU features (popcnt, pext) used by count_bit() and the slider attacks
 extern void init();
-extern bool BitboardInitialized;
+extern std::string cpu_features();	// eg. "popcnt pext"
 
 extern Key zob(int c, int p, int sq);
 extern Key zob_ep(int sq);
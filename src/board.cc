@@ -23,8 +23,6 @@ const std::string PieceLabel[NB_COLOR] = { "PNBRQK", "pnbrqk" };
 
 void Board::clear()
 {
-	assert(bb::BitboardInitialized);
-
 	turn = WHITE;
 	all[WHITE] = all[BLACK] = 0;
 	king_pos[WHITE] = king_pos[BLACK] = 0;
@@ -32,14 +30,61 @@ void Board::clear()
 	for (int sq = A1; sq <= H8; piece_on[sq++] = NO_PIECE);
 	std::memset(b, 0, sizeof(b));
 
-	sp = sp0 = game_stack;
+	sp = sp0 = &game_stack[0];
+	stack_end = sp + game_stack.size();
 	std::memset(sp, 0, sizeof(UndoInfo));
 	sp->epsq = NO_SQUARE;
+
+	ai = attack_ring;
+	ai->computed = 0;
 	move_count = 1;
 
 	initialized = true;
 }
 
+void Board::grow_stack()
+/* Called by play() when sp reaches the end of game_stack, which only happens in very long games.
+ * Doubles the stack size and rebases the pointers (on the new stack top, still to be filled). */
+{
+	const size_t n = sp - &game_stack[0], n0 = sp0 - &game_stack[0];
+	game_stack.resize(2 * game_stack.size());
+
+	sp = &game_stack[0] + n;
+	sp0 = &game_stack[0] + n0;
+	stack_end = &game_stack[0] + game_stack.size();
+}
+
+Board::Board(const Board& other)
+{
+	*this = other;
+}
+
+Board& Board::operator= (const Board& other)
+/* sp and sp0 point inside game_stack (and ai inside attack_ring), so they must be rebased on our own
+ * copy. Only the used part of the stack is copied. */
+{
+	std::memcpy(b, other.b, sizeof(b));
+	std::memcpy(all, other.all, sizeof(all));
+	std::memcpy(piece_on, other.piece_on, sizeof(piece_on));
+	std::memcpy(king_pos, other.king_pos, sizeof(king_pos));
+
+	game_stack.resize(other.game_stack.size());
+	const UndoInfo *base = &other.game_stack[0];
+	std::memcpy(&game_stack[0], base, (other.sp - base + 1) * sizeof(UndoInfo));
+	sp = &game_stack[0] + (other.sp - base);
+	sp0 = &game_stack[0] + (other.sp0 - base);
+	stack_end = &game_stack[0] + game_stack.size();
+
+	std::memcpy(attack_ring, other.attack_ring, sizeof(attack_ring));
+	ai = attack_ring + (other.ai - other.attack_ring);
+
+	turn = other.turn;
+	move_count = other.move_count;
+	initialized = other.initialized;
+
+	return *this;
+}
+
 void Board::set_fen(const std::string& _fen)
 {
 	clear();
@@ -92,14 +137,7 @@ void Board::set_fen(const std::string& _fen)
 
 	fen >> std::skipws >> sp->rule50 >> move_count;
 
-	const int us = turn, them = opp_color(us);
-	sp->pinned = hidden_checkers(1, us);
-	sp->dcheckers = hidden_checkers(0, us);
-
-	calc_attacks(us);
-	sp->attacked = calc_attacks(them);
-
-	sp->checkers = bb::test_bit(st().attacked, king_pos[us]) ? calc_checkers(us) : 0ULL;
+	sp->checkers = calc_checkers(turn);
 
 	assert(verify_keys());
 	assert(verify_psq());
@@ -182,8 +220,13 @@ std::ostream& operator<< (std::ostream& ostrm, const Board& B)
 void Board::play(move::move_t m)
 {
 	assert(initialized);
-	++sp;
+	if (++sp == stack_end)
+		grow_stack();
 	memcpy(sp, sp - 1, sizeof(UndoInfo));
+
+	if (++ai == attack_ring + 0x100)
+		ai = attack_ring;
+	ai->computed = PLAYED;
 	sp->last_move = m;
 	sp->rule50++;
 
@@ -212,7 +255,8 @@ void Board::play(move::move_t m)
 		sp->rule50 = 0;
 		const int inc_pp = us ? -8 : 8;
 		// set the epsq if double push, and ep square is attacked by enemy pawns
-		sp->epsq = tsq == fsq + 2 * inc_pp && bb::test_bit(get_attacks(them, PAWN), fsq + inc_pp)
+		sp->epsq = tsq == fsq + 2 * inc_pp
+			&& (bb::pattacks(us, fsq + inc_pp) & get_pieces(them, PAWN))
 			? fsq + inc_pp : NO_SQUARE;
 		// capture en passant
 		if (m.flag() == move::EN_PASSANT)
@@ -261,13 +305,10 @@ move_played:
 	sp->kpkey ^= bb::zob_turn();
 
 	sp->capture = capture;
-	sp->pinned = hidden_checkers(1, them);
-	sp->dcheckers = hidden_checkers(0, them);
-
-	sp->attacked = calc_attacks(us);
-	calc_attacks(them);
 
-	sp->checkers = bb::test_bit(st().attacked, king_pos[them]) ? calc_checkers(them) : 0ULL;
+	// attacks and pins are computed lazily, only when needed: many nodes never use them (eg. TT
+	// cutoffs), and calculating them was the main cost of play()
+	sp->checkers = calc_checkers(them);
 
 	assert(verify_keys());
 	assert(verify_psq());
@@ -319,45 +360,125 @@ move_undone:
 		--move_count;
 
 	--sp;
+	ai = ai == attack_ring ? attack_ring + 0xFF : ai - 1;
 
 	assert(verify_keys());
 	assert(verify_psq());
 }
 
-Bitboard Board::calc_attacks(int color) const
+void Board::calc_attacks(int color) const
+/* When the parent has the attacks of color, only what the last move can change is recomputed: the
+ * pieces of the types that moved (or were captured), and the sliders that saw one of the squares it
+ * changed (their rays can only be opened or blocked there). Pawns and King are always recomputed, as
+ * it is cheaper than testing. */
 {
 	assert(initialized);
-	Bitboard fss, r = 0;
+	const AttackInfo *parent = ai == attack_ring ? attack_ring + 0xFF : ai - 1;
+	const int done = color == WHITE ? WHITE_ATTACKS : BLACK_ATTACKS;
+	const Bitboard *pa = parent->attacks[color];
+	Bitboard *a = ai->attacks[color], fss;
+
+	int dirty = -1;		// bitmask of the piece types to recompute
+	if ((ai->computed & PLAYED) && (parent->computed & done)) {
+		const move::move_t m = st().last_move;
+		Bitboard changed = 0;
+		dirty = 0;
+
+		if (m) {
+			const int fsq = m.fsq(), tsq = m.tsq();
+			changed = (1ULL << fsq) | (1ULL << tsq);
+
+			if (color != turn) {
+				// color just moved
+				dirty |= 1 << piece_on[tsq];
+				if (m.flag() == move::CASTLING) {
+					dirty |= 1 << ROOK;
+					const int r = rank(fsq);
+					changed |= tsq > fsq
+						? (1ULL << square(r, FILE_H)) | (1ULL << square(r, FILE_F))
+						: (1ULL << square(r, FILE_A)) | (1ULL << square(r, FILE_D));
+				}
+			} else if (piece_ok(st().capture))
+				// color just lost a piece
+				dirty |= 1 << st().capture;
+
+			if (m.flag() == move::EN_PASSANT)
+				bb::set_bit(&changed, square(rank(fsq), file(tsq)));
+		}
+
+		if (dirty & (1 << QUEEN))
+			dirty |= (1 << BISHOP) | (1 << ROOK);
+		if (pa[BISHOP] & changed)
+			dirty |= 1 << BISHOP;
+		if (pa[ROOK] & changed)
+			dirty |= 1 << ROOK;
+	}
 
 	// Pawn
 	fss = get_pieces(color, PAWN);
-	r |= sp->attacks[color][PAWN]
-		= bb::shift_bit((fss & ~bb::FileA_bb), color ? -NB_FILE - 1 : +NB_FILE - 1)
+	a[PAWN] = bb::shift_bit((fss & ~bb::FileA_bb), color ? -NB_FILE - 1 : +NB_FILE - 1)
 		| bb::shift_bit((fss & ~bb::FileH_bb), color ? -NB_FILE + 1 : +NB_FILE + 1);
 
 	// Knight
-	sp->attacks[color][KNIGHT] = 0;
-	fss = get_pieces(color, KNIGHT);
-	while (fss)
-		r |= sp->attacks[color][KNIGHT] |= bb::nattacks(bb::pop_lsb(&fss));
+	if (dirty & (1 << KNIGHT)) {
+		a[KNIGHT] = 0;
+		fss = get_pieces(color, KNIGHT);
+		while (fss)
+			a[KNIGHT] |= bb::nattacks(bb::pop_lsb(&fss));
+	} else
+		a[KNIGHT] = pa[KNIGHT];
 
 	// Bishop + Queen (diagonal)
-	sp->attacks[color][BISHOP] = 0;
-	fss = get_BQ(color);
-	while (fss)
-		r |= sp->attacks[color][BISHOP] |= bb::battacks(bb::pop_lsb(&fss), st().occ);
+	if (dirty & (1 << BISHOP)) {
+		a[BISHOP] = 0;
+		fss = get_BQ(color);
+		while (fss)
+			a[BISHOP] |= bb::battacks(bb::pop_lsb(&fss), st().occ);
+	} else
+		a[BISHOP] = pa[BISHOP];
 
 	// Rook + Queen (lateral)
-	sp->attacks[color][ROOK] = 0;
-	fss = get_RQ(color);
-	while (fss)
-		r |= sp->attacks[color][ROOK] |= bb::rattacks(bb::pop_lsb(&fss), st().occ);
+	if (dirty & (1 << ROOK)) {
+		a[ROOK] = 0;
+		fss = get_RQ(color);
+		while (fss)
+			a[ROOK] |= bb::rattacks(bb::pop_lsb(&fss), st().occ);
+	} else
+		a[ROOK] = pa[ROOK];
 
 	// King
-	r |= sp->attacks[color][KING] = bb::kattacks(get_king_pos(color));
+	a[KING] = bb::kattacks(get_king_pos(color));
 
-	//All
-	return sp->attacks[color][NO_PIECE] = r;
+	// All
+	a[NO_PIECE] = a[PAWN] | a[KNIGHT] | a[BISHOP] | a[ROOK] | a[KING];
+	ai->computed |= done;
+	assert(verify_attacks(color));
+}
+
+bool Board::verify_attacks(int color) const
+{
+	const Bitboard *a = ai->attacks[color];
+	Bitboard fss, r[NB_PIECE + 1] = {};
+
+	fss = get_pieces(color, PAWN);
+	while (fss)
+		r[PAWN] |= bb::pattacks(color, bb::pop_lsb(&fss));
+	fss = get_pieces(color, KNIGHT);
+	while (fss)
+		r[KNIGHT] |= bb::nattacks(bb::pop_lsb(&fss));
+	fss = get_BQ(color);
+	while (fss)
+		r[BISHOP] |= bb::battacks(bb::pop_lsb(&fss), st().occ);
+	fss = get_RQ(color);
+	while (fss)
+		r[ROOK] |= bb::rattacks(bb::pop_lsb(&fss), st().occ);
+	r[KING] = bb::kattacks(get_king_pos(color));
+	r[NO_PIECE] = r[PAWN] | r[KNIGHT] | r[BISHOP] | r[ROOK] | r[KING];
+
+	for (int piece = PAWN; piece <= NO_PIECE; ++piece)
+		if (piece != QUEEN && a[piece] != r[piece])
+			return false;
+	return true;
 }
 
 Bitboard Board::hidden_checkers(bool find_pins, int color) const
@@ -496,7 +617,7 @@ bool Board::verify_psq() const
 bool Board::is_draw() const
 {
 	// 3-fold repetition
-	for (int i = 4, rep = 1; i <= std::min(st().rule50, int(sp - game_stack)); i += 2) {
+	for (int i = 4, rep = 1; i <= std::min(st().rule50, int(sp - &game_stack[0])); i += 2) {
 		// If the keys match, increment rep
 		// Stop when rep >= 2 or 3 once we've traversed the root
 		if ( (sp - i)->key == sp->key
@@ -524,10 +645,10 @@ Bitboard hanging_pieces(const Board& B)
 	const Bitboard our_pawns = B.get_pieces(us, PAWN);
 	const Bitboard our_pieces = B.get_pieces(us) ^ our_pawns;
 
-	const Bitboard attacked = B.get_attacks(them, NO_PIECE);
-	const Bitboard defended = B.get_attacks(us, NO_PIECE);
+	// our attacks are only needed (and computed) when something is attacked
+	const Bitboard attacked = (our_pawns ^ our_pieces) & B.get_attacks(them, NO_PIECE);
 
-	return ((our_pawns ^ our_pieces) & attacked & ~defended)
+	return (attacked ? attacked & ~B.get_attacks(us, NO_PIECE) : 0)
 		| (our_pieces & B.get_attacks(them, PAWN));
 }
 
@@ -582,7 +703,28 @@ Bitboard Board::get_attacks(int color, int piece) const
 {
 	assert(color_ok(color));
 	assert(PAWN <= piece && piece <= NO_PIECE && piece != QUEEN);
-	return st().attacks[color][piece];
+	if (!(ai->computed & (color == WHITE ? WHITE_ATTACKS : BLACK_ATTACKS)))
+		calc_attacks(color);
+	return ai->attacks[color][piece];
+}
+
+Bitboard Board::get_pinned() const
+// pinned pieces and discovery checkers are computed separately: callers only need one of them
+{
+	if (!(ai->computed & PINNED)) {
+		ai->pinned = hidden_checkers(1, turn);
+		ai->computed |= PINNED;
+	}
+	return ai->pinned;
+}
+
+Bitboard Board::get_dcheckers() const
+{
+	if (!(ai->computed & DCHECKERS)) {
+		ai->dcheckers = hidden_checkers(0, turn);
+		ai->computed |= DCHECKERS;
+	}
+	return ai->dcheckers;
 }
 
 int Board::get_turn() const
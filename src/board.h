@@ -14,6 +14,7 @@
 */
 #pragma once
 #include <string>
+#include <vector>
 #include "bitboard.h"
 #include "move.h"
 
@@ -27,11 +28,8 @@ enum {
 
 struct UndoInfo {
 	Key key, kpkey, mat_key;	// zobrist key, king+pawn key, material key
-	Bitboard pinned, dcheckers;	// pinned and discovery checkers for turn
-	Bitboard attacked;			// squares attacked by opp_color(turn)
 	Bitboard checkers;			// pieces checking turn's King
 	Bitboard occ;				// occupancy
-	Bitboard attacks[NB_COLOR][NB_PIECE + 1];
 	Eval psq[NB_COLOR];			// PSQ Eval by color
 
 	int capture;				// piece just captured
@@ -46,8 +44,21 @@ struct UndoInfo {
 	}
 };
 
+/* Data that can be derived from the position. It is not pushed on the undo stack, but computed
+ * lazily, on first access (see Board::get_attacks() and Board::get_pinned()), and for the attacks,
+ * incrementally from the parent's when possible (see Board::calc_attacks()) */
+struct AttackInfo {
+	int computed;				// bitmask of the fields that are up to date
+	Bitboard pinned, dcheckers;	// pinned and discovery checkers for turn
+	Bitboard attacks[NB_COLOR][NB_PIECE + 1];
+};
+
 class Board {
 public:
+	Board(): game_stack(0x400), initialized(false) {}
+	Board(const Board& other);
+	Board& operator= (const Board& other);
+
 	const UndoInfo& st() const;
 
 	int get_turn() const;
@@ -60,6 +71,8 @@ public:
 	Bitboard get_pieces(int color, int piece) const;
 
 	Bitboard get_attacks(int color, int piece) const;
+	Bitboard get_pinned() const;		// pinned pieces for turn
+	Bitboard get_dcheckers() const;		// discovery checkers for turn
 
 	Bitboard get_P() const;	
 	Bitboard get_N() const;
@@ -90,23 +103,35 @@ private:
 	Bitboard all[NB_COLOR];		// all[color]: squares occupied by pieces of color
 	int piece_on[NB_SQUARE];	// piece_on[sq]: what piece is on sq (can be NO_PIECE)
 
-	UndoInfo game_stack[0x400];	// undo stack: use fixed size C-array for speed
+	std::vector<UndoInfo> game_stack;	// undo stack: grows in play() when full (see grow_stack())
 	UndoInfo *sp;				// pointer to the stack top
 	UndoInfo *sp0;				// see set_unwind() and unwind()
+	UndoInfo *stack_end;		// end of game_stack
+
+	// AttackInfo of the current position, and its ancestors up to 0x100 plies (> MAX_PLY), so that
+	// they survive undo(). The UndoInfo pushed in play() only contains what cannot be derived.
+	AttackInfo attack_ring[0x100];
+	AttackInfo *ai;				// AttackInfo of the current position (in attack_ring)
 
 	int turn;
 	int king_pos[NB_COLOR];
 	int move_count;				// full move count, as per FEN standard
 	bool initialized;
 
+	// AttackInfo::computed flags: attacks (by color), pinned, dcheckers. PLAYED means that the
+	// position was reached by play(), so the previous AttackInfo in the ring is the parent's.
+	enum { WHITE_ATTACKS = 1, BLACK_ATTACKS = 2, PINNED = 4, DCHECKERS = 8, PLAYED = 16 };
+
 	void clear();
+	void grow_stack();
 	void set_square(int color, int piece, int sq, bool calc = true);
 	void clear_square(int color, int piece, int sq, bool calc = true);
 
-	Bitboard calc_attacks(int color) const;
+	void calc_attacks(int color) const;
 	Bitboard calc_checkers(int kcolor) const;
 	Bitboard hidden_checkers(bool find_pins, int color) const;
 
+	bool verify_attacks(int color) const;
 	bool verify_keys() const;
 	bool verify_psq() const;
 };
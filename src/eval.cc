@@ -17,8 +17,9 @@
 */
 #include <cstring>
 #include "eval.h"
-#include "kpk.h"
+#include "bitbase.h"
 #include "psq.h"
+#include "uci.h"
 
 namespace {
 
@@ -28,32 +29,99 @@ int KingDistanceToSafety[NB_COLOR][NB_SQUARE];
 // Minimum taxi distance for to the corner of the given color. Used for KBNK mating technique.
 int KingTaxiDistanceToCorner[NB_COLOR][NB_SQUARE];
 
+/* Pawn hash table, indexed by kpkey, as it also caches King dependant terms (shield and storm, King
+ * distance to passers). It is shared by all threads. Like the TT, entries are lockless: key ^ data
+ * is stored, so that an entry torn by a concurrent write is a miss. Buckets of 2 entries, the most
+ * recently stored first. */
 class PawnCache {
 public:
 	struct Entry {
 		Key key;
 		Eval eval_white;
 		Bitboard passers;
+
+		uint64_t data() const {
+			return ((uint64_t)(uint32_t)eval_white.op | (uint64_t)(uint32_t)eval_white.eg << 32)
+				^ passers;
+		}
 	};
 
-	PawnCache() {
+	PawnCache(): buf(nullptr), count(0) {}
+	~PawnCache() { delete[] buf; }
+
+	void alloc(uint64_t size);
+	bool probe(Key key, Entry *e) const;
+	void store(Key key, const Entry& e);
+
+private:
+	Entry *buf;
+	size_t count;	// number of entries (power of two)
+};
+
+void PawnCache::alloc(uint64_t size)
+{
+	const size_t new_count = 1ULL << bb::msb(std::max<uint64_t>(size / sizeof(Entry), 2));
+	if (new_count != count) {
+		delete[] buf;
+		buf = new Entry[new_count];
+		count = new_count;
+	}
+	std::memset(buf, 0, count * sizeof(Entry));
+}
+
+bool PawnCache::probe(Key key, Entry *e) const
+{
+	const Entry *bucket = &buf[key & (count - 2)];
+	for (int i = 0; i < 2; ++i) {
+		*e = bucket[i];
+		e->key ^= e->data();
+		if (e->key == key)
+			return true;
+	}
+	return false;
+}
+
+void PawnCache::store(Key key, const Entry& e)
+{
+	Entry *bucket = &buf[key & (count - 2)];
+	bucket[1] = bucket[0];
+	bucket[0] = e;
+	bucket[0].key = key ^ e.data();
+}
+
+PawnCache PC;
+
+/* Eval cache, indexed by the full zobrist key, and shared by all threads. Each entry is a single 64
+ * bit word: the high 48 bits of the key, and the symmetric eval in the low 16 bits. Reading or writing
+ * an aligned word is atomic, so no locking or XOR trick is needed. */
+class EvalCache {
+public:
+	EvalCache() {
+		clear();
+	}
+
+	void clear() {
 		std::memset(buf, 0, sizeof(buf));
 	}
 
-	Entry *probe(Key key) {
-		return &buf[key & (count - 1)];
+	bool probe(Key key, int *eval) const {
+		const uint64_t e = buf[key & (count - 1)];
+		*eval = (int16_t)(e & 0xFFFF);
+		return !((e ^ key) & ~0xFFFFULL);
+	}
+
+	void store(Key key, int eval) {
+		buf[key & (count - 1)] = (key & ~0xFFFFULL) | (uint16_t)eval;
 	}
 
 private:
-	static const int count = 0x10000;
-	Entry buf[count];
+	static const int count = 1 << 16;	// index bits must not overlap the key bits in the entry
+	uint64_t buf[count];
 };
 
-PawnCache PC;
+EvalCache EC;
 
 // Known draws (with recognizer function)
-static const Key KPK  = 0x110000000001ULL;
-static const Key KKP  = 0x110000000010ULL;
 static const Key KBPK = 0x110000010001ULL;
 static const Key KKBP = 0x110000100010ULL;
 
@@ -61,12 +129,93 @@ static const Key KKBP = 0x110000100010ULL;
 static const Key KBNK = 0x110000010100ULL;
 static const Key KKBN = 0x110000101000ULL;
 
+// Specialised endgame evaluation, selected by material (see MaterialEntry::endgame)
+enum { NO_ENDGAME, BITBASE_ENDGAME, KBPK_ENDGAME, KBNK_ENDGAME };
+
+/* Everything that only depends on material. The phase is not here, because it is calculated from
+ * piece_psq[], which depends on squares too. */
+struct MaterialEntry {
+	int imbalance;				// minor piece imbalance, from White's point of view
+	int eval_factor[NB_COLOR];	// endgame scaling (out of 16), indexed by the strong side
+	bool ocb;					// one bishop each: scale down if they are of opposite colors
+	int endgame;				// NO_ENDGAME, or which specialised function to use
+
+	uint64_t pack() const;
+	void unpack(uint64_t data);
+};
+
+uint64_t MaterialEntry::pack() const
+{
+	return (uint64_t)(uint16_t)imbalance
+		^ (uint64_t)eval_factor[WHITE] << 16
+		^ (uint64_t)eval_factor[BLACK] << 24
+		^ (uint64_t)ocb << 32
+		^ (uint64_t)endgame << 40;
+}
+
+void MaterialEntry::unpack(uint64_t data)
+{
+	imbalance = (int16_t)(data & 0xFFFF);
+	eval_factor[WHITE] = (data >> 16) & 0xFF;
+	eval_factor[BLACK] = (data >> 24) & 0xFF;
+	ocb = (data >> 32) & 1;
+	endgame = (data >> 40) & 0xFF;
+}
+
+/* Material hash table, indexed by mat_key, and shared by all threads. Like the TT, entries are
+ * lockless: key ^ data is stored, so that an entry torn by a concurrent write is a miss. */
+class MaterialCache {
+public:
+	MaterialCache() {
+		std::memset(buf, 0, sizeof(buf));
+	}
+
+	bool probe(Key mat_key, MaterialEntry *me) const {
+		const Slot& s = buf[index(mat_key)];
+		const uint64_t data = s.data;
+		if ((s.key ^ data) != mat_key)
+			return false;
+		me->unpack(data);
+		return true;
+	}
+
+	void store(Key mat_key, const MaterialEntry& me) {
+		Slot& s = buf[index(mat_key)];
+		s.data = me.pack();
+		s.key = mat_key ^ s.data;
+	}
+
+private:
+	struct Slot {
+		Key key;
+		uint64_t data;
+	};
+
+	// mat_key is a sum of piece counts, so mix its bits before using them as an index
+	static size_t index(Key mat_key) {
+		return (mat_key * 0x9E3779B97F4A7C15ULL) >> (64 - 13);
+	}
+
+	static const int count = 1 << 13;
+	Slot buf[count];
+};
+
+MaterialCache MC;
+
+int calc_phase(const board::Board& B)
+{
+	static const int total = 4 * (vN + vB + vR) + 2 * vQ;
+	return (B.st().piece_psq[WHITE] + B.st().piece_psq[BLACK]) * 1024 / total;
+}
+
 class EvalInfo {
 public:
 	explicit EvalInfo(const board::Board *_B): B(_B) {
 		e[WHITE] = e[BLACK] = {0, 0};
 	}
 
+	const MaterialEntry& probe_material();
+
 	void select_side(int color);
 	void eval_material();
 	void eval_mobility();
@@ -78,6 +227,7 @@ public:
 
 private:
 	const board::Board *B;
+	MaterialEntry me;
 	Eval e[NB_COLOR];
 	int us, them, our_ksq, their_ksq;
 	Bitboard our_pawns, their_pawns;
@@ -91,7 +241,6 @@ private:
 	void eval_passer(int sq, Eval* res);
 	void eval_passer_interaction(int sq);
 
-	int calc_phase() const;
 	Eval eval_white() const {
 		Eval tmp(e[WHITE]);
 		return tmp -= e[BLACK];
@@ -291,26 +440,28 @@ void EvalInfo::eval_passer_interaction(int sq)
 void EvalInfo::eval_pawns()
 {
 	const Key key = B->st().kpkey;
-	PawnCache::Entry *h = PC.probe(key);
+	PawnCache::Entry h;
 
-	if (h->key == key)
-		e[WHITE] += h->eval_white;
-	else {
+	++eval::PawnStats.probes;
+	if (PC.probe(key, &h)) {
+		++eval::PawnStats.hits;
+		e[WHITE] += h.eval_white;
+	} else {
 		const Eval ew0 = eval_white();
-		h->key = key;
 
 		select_side(WHITE);
-		h->passers = do_eval_pawns();
+		h.passers = do_eval_pawns();
 
 		select_side(BLACK);
-		h->passers |= do_eval_pawns();
+		h.passers |= do_eval_pawns();
 
-		h->eval_white = eval_white();
-		h->eval_white -= ew0;
+		h.eval_white = eval_white();
+		h.eval_white -= ew0;
+		PC.store(key, h);
 	}
 
 	// piece-dependant passed pawn scoring
-	Bitboard b = h->passers;
+	Bitboard b = h.passers;
 	while (b)
 		eval_passer_interaction(bb::pop_lsb(&b));
 }
@@ -466,43 +617,62 @@ void EvalInfo::eval_pieces()
 	}
 }
 
-int EvalInfo::calc_phase() const
+const MaterialEntry& EvalInfo::probe_material()
 {
-	static const int total = 4 * (vN + vB + vR) + 2 * vQ;
-	return (B->st().piece_psq[WHITE] + B->st().piece_psq[BLACK]) * 1024 / total;
+	const Key mat_key = B->st().mat_key;
+	if (MC.probe(mat_key, &me))
+		return me;
+
+	for (int strong_side = WHITE; strong_side <= BLACK; ++strong_side) {
+		int& eval_factor = me.eval_factor[strong_side];
+		eval_factor = 16;
+
+		// Strongest side has no pawns
+		if (!B->get_pieces(strong_side, PAWN)) {
+			if (board::has_mating_material(*B, strong_side)) {
+				// Half the endgame eval, unless we're in a KXK situation where X is mating material
+				if (bb::several_bits(B->get_pieces(opp_color(strong_side))))
+					eval_factor = 8;	// CLOP
+			} else
+				// No mating material: divide endgame eval by 4
+				eval_factor = 4;		// CLOP
+		}
+	}
+
+	// Opposite color bishop candidate: each side has exactly one bishop
+	me.ocb = (mat_key & 0xFF0000ULL) == 0x110000ULL;
+
+	// Basic material imbalance, based on counting minor pieces
+	const int wm = bb::count_bit(B->get_NB(WHITE));
+	const int bm = bb::count_bit(B->get_NB(BLACK));
+	me.imbalance = 2 * (wm - bm) * bb::count_bit(B->get_P());
+
+	me.endgame = bitbase::has(mat_key) ? BITBASE_ENDGAME
+		: mat_key == KBPK || mat_key == KKBP ? KBPK_ENDGAME
+		: mat_key == KBNK || mat_key == KKBN ? KBNK_ENDGAME
+		: NO_ENDGAME;
+
+	MC.store(mat_key, me);
+	return me;
 }
 
 int EvalInfo::interpolate()
 {
 	us = B->get_turn(), them = opp_color(us);
 	const int strong_side = e[BLACK].eg > e[WHITE].eg;
-	int eval_factor = 16;
-
-	// Strongest side has no pawns
-	if (!B->get_pieces(strong_side, PAWN)) {
-		if (board::has_mating_material(*B, strong_side)) {
-			// Half the endgame eval, unless we're in a KXK situation where X is mating material
-			if (bb::several_bits(B->get_pieces(opp_color(strong_side))))
-				eval_factor = 8;	// CLOP
-		} else
-			// No mating material: divide endgame eval by 4
-			eval_factor = 4;		// CLOP
-	}
+	int eval_factor = me.eval_factor[strong_side];
 
 	// Opposite color bishop
-	if (eval_factor == 16 && (B->st().mat_key & 0xFF0000ULL) == 0x110000ULL) {
+	if (eval_factor == 16 && me.ocb) {
 		// Each side has exactly one bishop: are the two bishops on opposite color squares?
 		const Bitboard b = B->get_B();
 		if ((b & bb::WhiteSquares) && (b & bb::BlackSquares))
 			eval_factor = 12;		// CLOP
 	}
 
-	// Basic material imbalance, based on counting minor pieces
-	const int om = bb::count_bit(B->get_NB(us));
-	const int tm = bb::count_bit(B->get_NB(them));
-	const int imbalance = 2 * (om - tm) * bb::count_bit(B->get_P());
-	
-	const int phase = calc_phase();
+	const int imbalance = us == WHITE ? me.imbalance : -me.imbalance;
+
+	const int phase = calc_phase(*B);
 	const int op = e[us].op - e[them].op, eg = e[us].eg - e[them].eg;
 	const int eval = (phase * op + (1024 - phase) * eg * eval_factor / 16) / 1024;
 
@@ -522,26 +692,10 @@ void EvalInfo::adjust_kbnk()
 	e[weak_side].eg += 32 * (KingTaxiDistanceToCorner[bcolor][weak_ksq] - 4);
 }
 
-bool kpk_draw(const board::Board& B)
+bool bitbase_draw(const board::Board& B)
 {
-	const int us = B.get_pieces(WHITE, PAWN) ? WHITE : BLACK;
-	int wk = B.get_king_pos(us), bk = B.get_king_pos(opp_color(us));
-	int wp = bb::lsb(B.get_pieces(us, PAWN));
-	int stm = B.get_turn();
-
-	if (us == BLACK) {
-		wk = rank_mirror(wk);
-		bk = rank_mirror(bk);
-		wp = rank_mirror(wp);
-		stm = opp_color(stm);
-	}
-	if (file(wp) > FILE_D) {
-		wk = file_mirror(wk);
-		bk = file_mirror(bk);
-		wp = file_mirror(wp);
-	}
-
-	return !kpk::probe(wk, bk, stm, wp);
+	int winner;
+	return bitbase::probe(B, &winner) && winner == NO_COLOR;
 }
 
 bool kbpk_draw(const board::Board& B)
@@ -558,6 +712,48 @@ bool kbpk_draw(const board::Board& B)
 		&& bb::kdist(their_king, prom_sq) - (stm != us) <= bb::kdist(pawn, prom_sq);
 }
 
+bool endgame_bitbase(const board::Board& B, EvalInfo&)
+{
+	return bitbase_draw(B);
+}
+
+bool endgame_kbpk(const board::Board& B, EvalInfo&)
+{
+	return kbpk_draw(B);
+}
+
+bool endgame_kbnk(const board::Board&, EvalInfo& ei)
+{
+	ei.adjust_kbnk();
+	return false;
+}
+
+// Specialised endgame functions, indexed by MaterialEntry::endgame. They return true when the
+// position is a known draw, and otherwise can adjust the eval.
+typedef bool (*EndgameFn)(const board::Board& B, EvalInfo& ei);
+const EndgameFn Endgames[] = { nullptr, endgame_bitbase, endgame_kbpk, endgame_kbnk };
+
+int do_symmetric_eval(const board::Board& B)
+{
+	EvalInfo ei(&B);
+
+	// Recognize some specific endgames
+	const MaterialEntry& me = ei.probe_material();
+	if (me.endgame && Endgames[me.endgame](B, ei))
+		return 0;
+
+	ei.eval_pawns();
+	for (int color = WHITE; color <= BLACK; ++color) {
+		ei.select_side(color);
+		ei.eval_material();
+		ei.eval_mobility();
+		ei.eval_safety();
+		ei.eval_pieces();
+	}
+
+	return ei.interpolate();
+}
+
 int stand_pat_penalty(const board::Board& B, Bitboard hanging)
 {
 	if (bb::several_bits(hanging)) {
@@ -569,7 +765,7 @@ int stand_pat_penalty(const board::Board& B, Bitboard hanging)
 			piece = std::min(piece, p);
 		}
 		return psq::material(piece).op / 2;
-	} else if (hanging & B.st().pinned) {
+	} else if (hanging && (hanging & B.get_pinned())) {
 		// Only one piece hanging, but also pinned. Return half its value.
 		assert(bb::count_bit(hanging) == 1);
 		const int sq = bb::lsb(hanging), piece = B.get_piece_on(sq);
@@ -583,9 +779,21 @@ int stand_pat_penalty(const board::Board& B, Bitboard hanging)
 
 namespace eval {
 
+thread_local CacheStats PawnStats, EvalStats;
+
+void init_pawn_cache(uint64_t size)
+{
+	PC.alloc(size);
+}
+
+void clear_eval_cache()
+{
+	EC.clear();
+}
+
 void init()
 {
-	kpk::init();
+	PC.alloc(uint64_t(uci::PawnHash) << 20);
 
 	for (int c = WHITE; c <= BLACK; ++c)
 		for (int sq = A1; sq <= H8; ++sq) {
@@ -606,27 +814,36 @@ void init()
 int symmetric_eval(const board::Board& B)
 {
 	assert(!B.is_check());
-	EvalInfo ei(&B);
+	const Key key = B.get_key();
+	int eval;
 
-	if (bb::count_bit(B.st().occ) <= 4) {
-		// Recognize some specific endgames
-		const Bitboard mk = B.st().mat_key;
-		if (is_tb_draw(B))
-			return 0;
-		else if (mk == KBNK || mk == KKBN)
-			ei.adjust_kbnk();
+	++EvalStats.probes;
+	if (EC.probe(key, &eval)) {
+		++EvalStats.hits;
+		return eval;
 	}
 
-	ei.eval_pawns();
-	for (int color = WHITE; color <= BLACK; ++color) {
-		ei.select_side(color);
-		ei.eval_material();
-		ei.eval_mobility();
-		ei.eval_safety();
-		ei.eval_pieces();
-	}
+	eval = do_symmetric_eval(B);
+	EC.store(key, eval);
+	return eval;
+}
 
-	return ei.interpolate();
+bool lazy_eval(const board::Board& B, int *eval)
+/* Material and PSQ only. Returns false when that is no estimate of the eval at all: in endgames that
+ * are recognized (bitbase draws, KBPK with the wrong bishop...), or scaled down (KNNK...). */
+{
+	EvalInfo ei(&B);
+	const MaterialEntry& me = ei.probe_material();
+	if (me.endgame != NO_ENDGAME || me.eval_factor[WHITE] < 16 || me.eval_factor[BLACK] < 16)
+		return false;
+
+	const int us = B.get_turn(), them = opp_color(us);
+	const int phase = calc_phase(B);
+	const int op = B.st().psq[us].op - B.st().psq[them].op;
+	const int eg = B.st().psq[us].eg - B.st().psq[them].eg;
+
+	*eval = (phase * op + (1024 - phase) * eg) / 1024;
+	return true;
 }
 
 int asymmetric_eval(const board::Board& B, Bitboard hanging)
@@ -641,7 +858,7 @@ bool is_tb_draw(const board::Board& B)
 // Used both in the eval, and as interior node recognizers in the search (pseudo-TB pruning).
 {
 	const Bitboard mk = B.st().mat_key;
-	bool r = ((mk == KPK || mk == KKP) && kpk_draw(B))
+	bool r = bitbase_draw(B)
 		|| ((mk == KBPK || mk == KKBP) && kbpk_draw(B));
 
 	return r;
@@ -18,8 +18,21 @@
 namespace eval {
 
 extern void init();
+extern void init_pawn_cache(uint64_t size);	// size in bytes, shared by all threads
+extern void clear_eval_cache();
+
+// Cache statistics of the calling thread (displayed by bench)
+struct CacheStats {
+	uint64_t probes, hits;
+
+	void clear() { probes = hits = 0; }
+	double hit_rate() const { return probes ? 100.0 * hits / probes : 0; }
+};
+
+extern thread_local CacheStats PawnStats, EvalStats;
 
 extern int symmetric_eval(const board::Board& B);
+extern bool lazy_eval(const board::Board& B, int *eval);	// material and PSQ only, see qsearch()
 extern int asymmetric_eval(const board::Board& B, Bitboard hanging_pieces);
 
 extern bool is_tb_draw(const board::Board& B);
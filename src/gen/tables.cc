@@ -0,0 +1,306 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * Build time generator of the lookup tables of bitboard.cc (attacks, magic databases, zobrist keys,
+ * etc.). It writes them as const arrays on stdout, which make.sh puts in tables.inc, so they end up
+ * in the read-only data of the executable: nothing to compute at startup, and the pages are shared
+ * by all the running processes.
+*/
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#include "../magics.h"
+#include "../prng.h"
+
+namespace {
+
+Key Zob[NB_COLOR][NB_PIECE][NB_SQUARE], ZobTurn, ZobEp[NB_SQUARE], ZobCastle[16];
+
+Bitboard Between[NB_SQUARE][NB_SQUARE];
+Bitboard Direction[NB_SQUARE][NB_SQUARE];
+
+Bitboard InFront[NB_COLOR][NB_RANK];
+Bitboard AdjacentFiles[NB_FILE];
+Bitboard SquaresInFront[NB_COLOR][NB_SQUARE];
+Bitboard PawnSpan[NB_COLOR][NB_SQUARE];
+Bitboard Shield[NB_COLOR][NB_SQUARE];
+
+Bitboard KAttacks[NB_SQUARE], NAttacks[NB_SQUARE];
+Bitboard PAttacks[NB_COLOR][NB_SQUARE];
+Bitboard BPseudoAttacks[NB_SQUARE], RPseudoAttacks[NB_SQUARE];
+
+int KingDistance[NB_SQUARE][NB_SQUARE];
+
+Bitboard magic_bb_r_db[magic_bb_r_size];
+Bitboard magic_bb_b_db[magic_bb_b_size];
+
+// PEXT databases: same sizes, but indexed by pext(occ, mask) instead of the magic hash
+Bitboard pext_bb_r_db[magic_bb_r_size], pext_bb_b_db[magic_bb_b_size];
+uint64_t pext_bb_r_offset[NB_SQUARE], pext_bb_b_offset[NB_SQUARE];
+
+const int Bdir[4][2] = { {-1,-1}, {-1, 1}, { 1,-1}, { 1, 1} };
+const int Rdir[4][2] = { {-1, 0}, { 0,-1}, { 0, 1}, { 1, 0} };
+
+/* The engine's types.cc and bitboard.cc are not linked in (bitboard.cc includes what we generate),
+ * so we need our own square and bit helpers */
+
+bool sq_ok(int r, int f) { return 0 <= r && r < NB_RANK && 0 <= f && f < NB_FILE; }
+int sq_of(int r, int f) { return NB_FILE * r + f; }
+Bitboard bit(int sq) { return 1ULL << sq; }
+Bitboard rank_bb(int r) { return 0xFFULL << (NB_FILE * r); }
+Bitboard file_bb(int f) { return 0x0101010101010101ULL << f; }
+
+void safe_add_bit(Bitboard *b, int r, int f)
+{
+	if (sq_ok(r, f))
+		*b |= bit(sq_of(r, f));
+}
+
+Bitboard calc_sliding_attacks(int sq, Bitboard occ, const int dir[4][2])
+{
+	const int r = sq / NB_FILE, f = sq % NB_FILE;
+	Bitboard result = 0;
+
+	for (int i = 0; i < 4; ++i) {
+		const int dr = dir[i][0], df = dir[i][1];
+		int _r, _f;
+
+		for (_r = r + dr, _f = f + df; sq_ok(_r, _f); _r += dr, _f += df) {
+			const int _sq = sq_of(_r, _f);
+			result |= bit(_sq);
+			if (occ & bit(_sq))
+				break;
+		}
+	}
+
+	return result;
+}
+
+void init_magic_db(Bitboard *db, const Bitboard mask[], const Bitboard magics[], const int shift[],
+	const int offset[], const int dir[4][2])
+{
+	for (int i = A1; i <= H8; i++) {
+		// enumerate all the subsets of mask[i] (Carry-Rippler trick)
+		Bitboard occ = 0;
+		do {
+			const size_t idx = (occ * magics[i]) >> shift[i];
+			db[offset[i] + idx] = calc_sliding_attacks(i, occ, dir);
+			occ = (occ - mask[i]) & mask[i];
+		} while (occ);
+	}
+}
+
+// Software version of the BMI2 instruction (we cannot assume the build machine has it)
+uint64_t pext(Bitboard b, Bitboard mask)
+{
+	uint64_t result = 0;
+
+	for (uint64_t bit_out = 1; mask; bit_out <<= 1, mask &= mask - 1)
+		if (b & mask & -mask)
+			result |= bit_out;
+
+	return result;
+}
+
+void init_pext_db(Bitboard *db, uint64_t *offset, const Bitboard mask[], const int dir[4][2])
+{
+	for (int i = A1, size = 0; i <= H8; size += 1 << __builtin_popcountll(mask[i++])) {
+		offset[i] = size;
+		Bitboard occ = 0;
+		do {
+			db[offset[i] + pext(occ, mask[i])] = calc_sliding_attacks(i, occ, dir);
+			occ = (occ - mask[i]) & mask[i];
+		} while (occ);
+	}
+}
+
+void init()
+{
+	init_magic_db(magic_bb_b_db, magic_bb_b_mask, magic_bb_b_magics, magic_bb_b_shift,
+		magic_bb_b_offset, Bdir);
+	init_magic_db(magic_bb_r_db, magic_bb_r_mask, magic_bb_r_magics, magic_bb_r_shift,
+		magic_bb_r_offset, Rdir);
+	init_pext_db(pext_bb_b_db, pext_bb_b_offset, magic_bb_b_mask, Bdir);
+	init_pext_db(pext_bb_r_db, pext_bb_r_offset, magic_bb_r_mask, Rdir);
+
+	/* Generate Zobrist keys*/
+
+	PRNG prng;
+	for (int c = WHITE; c <= BLACK; c++)
+		for (int p = PAWN; p <= KING; p++)
+			for (int sq = A1; sq <= H8; Zob[c][p][sq++] = prng.rand());
+
+	ZobTurn = prng.rand();
+	for (int crights = 0; crights < 16; ZobCastle[crights++] = prng.rand());
+	for (int sq = A1; sq <= H8; ZobEp[sq++] = prng.rand());
+
+	/* NAttacks[s], KAttacks[s], Pattacks[c][s] */
+
+	const int Kdir[8][2] = { { -1, -1}, { -1, 0}, { -1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1} };
+	const int Ndir[8][2] = { { -2, -1}, { -2, 1}, { -1, -2}, { -1, 2}, {1, -2}, {1, 2}, {2, -1}, {2, 1} };
+	const int Pdir[2][2] = { {1, -1}, {1, 1} };
+
+	for (int sq = A1; sq <= H8; ++sq) {
+		const int r = sq / NB_FILE;
+		const int f = sq % NB_FILE;
+
+		for (int d = 0; d < 8; d++) {
+			safe_add_bit(&NAttacks[sq], r + Ndir[d][0], f + Ndir[d][1]);
+			safe_add_bit(&KAttacks[sq], r + Kdir[d][0], f + Kdir[d][1]);
+		}
+
+		for (int d = 0; d < 2; d++) {
+			safe_add_bit(&PAttacks[WHITE][sq], r + Pdir[d][0], f + Pdir[d][1]);
+			safe_add_bit(&PAttacks[BLACK][sq], r - Pdir[d][0], f - Pdir[d][1]);
+		}
+
+		BPseudoAttacks[sq] = calc_sliding_attacks(sq, 0, Bdir);
+		RPseudoAttacks[sq] = calc_sliding_attacks(sq, 0, Rdir);
+	}
+
+	/* Between[s1][s2] and Direction[s1][s2] */
+
+	for (int sq = A1; sq <= H8; ++sq) {
+		const int r = sq / NB_FILE;
+		const int f = sq % NB_FILE;
+
+		for (int i = 0; i < 8; i++) {
+			Bitboard mask = 0;
+			const int dr = Kdir[i][0], df = Kdir[i][1];
+			int _r, _f, _sq;
+
+			for (_r = r + dr, _f = f + df; sq_ok(_r, _f); _r += dr, _f += df) {
+				_sq = sq_of(_r, _f);
+				mask |= bit(_sq);
+				Between[sq][_sq] = mask;
+			}
+
+			for (_r = r + dr, _f = f + df; sq_ok(_r, _f); _r += dr, _f += df)
+				Direction[sq][sq_of(_r, _f)] = mask;
+		}
+	}
+
+	/* AdjacentFile[f] and InFront[c][r] */
+
+	for (int f = FILE_A; f <= FILE_H; f++) {
+		if (f > FILE_A) AdjacentFiles[f] |= file_bb(f - 1);
+		if (f < FILE_H) AdjacentFiles[f] |= file_bb(f + 1);
+	}
+
+	for (int rw = RANK_7, rb = RANK_2; rw >= RANK_1; rw--, rb++) {
+		InFront[WHITE][rw] = InFront[WHITE][rw + 1] | rank_bb(rw + 1);
+		InFront[BLACK][rb] = InFront[BLACK][rb - 1] | rank_bb(rb - 1);
+	}
+
+	/* SquaresInFront[c][sq], PawnSpan[c][sq], Shield[c][sq] */
+
+	for (int us = WHITE; us <= BLACK; ++us) {
+		for (int sq = A1; sq <= H8; ++sq) {
+			const int r = sq / NB_FILE, f = sq % NB_FILE;
+			SquaresInFront[us][sq] = file_bb(f) & InFront[us][r];
+			PawnSpan[us][sq] = AdjacentFiles[f] & InFront[us][r];
+			Shield[us][sq] = KAttacks[sq] & InFront[us][r];
+		}
+	}
+
+	/* KingDistance[s1][s2] */
+
+	for (int s1 = A1; s1 <= H8; ++s1)
+		for (int s2 = A1; s2 <= H8; ++s2)
+			KingDistance[s1][s2] = std::max(std::abs(s1 % NB_FILE - s2 % NB_FILE),
+				std::abs(s1 / NB_FILE - s2 / NB_FILE));
+}
+
+/* Prints a as a const array of the given dimensions (at most 3), 4 values per line */
+
+void print(const char *type, const char *name, const uint64_t *a, std::vector<int> dims, bool hex = true)
+{
+	std::printf("const %s %s", type, name);
+	for (int d : dims)
+		std::printf("[%d]", d);
+	std::printf(" =");
+
+	// end[k]: number of values in a sub-array of depth k
+	std::vector<size_t> end(dims.size(), 1);
+	for (int k = int(dims.size()) - 1; k >= 0; --k)
+		end[k] = dims[k] * (k + 1 < int(dims.size()) ? end[k + 1] : 1);
+
+	for (size_t i = 0; i < end[0]; ++i) {
+		// open the sub-arrays starting here
+		for (size_t k = 0; k < dims.size(); ++k)
+			if (i % end[k] == 0) {
+				if (k)
+					std::printf("\n%.*s{", int(k), "\t\t\t");
+				else
+					std::printf(" {");
+			}
+
+		if (i % 4 == 0)
+			std::printf("\n%.*s", int(dims.size()), "\t\t\t");
+		else
+			std::printf(" ");
+
+		if (hex)
+			std::printf("0x%016" PRIx64 "ull,", a[i]);
+		else
+			std::printf("%d,", int(a[i]));
+
+		// close the sub-arrays ending here
+		for (int k = int(dims.size()) - 1; k >= 0; --k)
+			if ((i + 1) % end[k] == 0)
+				std::printf("\n%.*s}%s", k, "\t\t\t", k ? "," : ";\n\n");
+	}
+}
+
+}	// namespace
+
+int main()
+{
+	init();
+
+	std::printf("// Generated by gen/tables.cc: do not edit\n\n");
+
+	print("Key", "Zob", &Zob[0][0][0], {NB_COLOR, NB_PIECE, NB_SQUARE});
+	std::printf("const Key ZobTurn = 0x%016" PRIx64 "ull;\n\n", ZobTurn);
+	print("Key", "ZobEp", ZobEp, {NB_SQUARE});
+	print("Key", "ZobCastle", ZobCastle, {16});
+
+	print("Bitboard", "Between", &Between[0][0], {NB_SQUARE, NB_SQUARE});
+	print("Bitboard", "Direction", &Direction[0][0], {NB_SQUARE, NB_SQUARE});
+
+	print("Bitboard", "InFront", &InFront[0][0], {NB_COLOR, NB_RANK});
+	print("Bitboard", "AdjacentFiles", AdjacentFiles, {NB_FILE});
+	print("Bitboard", "SquaresInFront", &SquaresInFront[0][0], {NB_COLOR, NB_SQUARE});
+	print("Bitboard", "PawnSpan", &PawnSpan[0][0], {NB_COLOR, NB_SQUARE});
+	print("Bitboard", "Shield", &Shield[0][0], {NB_COLOR, NB_SQUARE});
+
+	print("Bitboard", "KAttacks", KAttacks, {NB_SQUARE});
+	print("Bitboard", "NAttacks", NAttacks, {NB_SQUARE});
+	print("Bitboard", "PAttacks", &PAttacks[0][0], {NB_COLOR, NB_SQUARE});
+	print("Bitboard", "BPseudoAttacks", BPseudoAttacks, {NB_SQUARE});
+	print("Bitboard", "RPseudoAttacks", RPseudoAttacks, {NB_SQUARE});
+
+	uint64_t kdist[NB_SQUARE][NB_SQUARE];
+	for (int s1 = A1; s1 <= H8; ++s1)
+		for (int s2 = A1; s2 <= H8; ++s2)
+			kdist[s1][s2] = KingDistance[s1][s2];
+	print("int", "KingDistance", &kdist[0][0], {NB_SQUARE, NB_SQUARE}, false);
+
+	print("int", "pext_bb_r_offset", pext_bb_r_offset, {NB_SQUARE}, false);
+	print("int", "pext_bb_b_offset", pext_bb_b_offset, {NB_SQUARE}, false);
+	print("Bitboard", "pext_bb_r_db", pext_bb_r_db, {magic_bb_r_size});
+	print("Bitboard", "pext_bb_b_db", pext_bb_b_db, {magic_bb_b_size});
+	print("Bitboard", "magic_bb_r_db", magic_bb_r_db, {magic_bb_r_size});
+	print("Bitboard", "magic_bb_b_db", magic_bb_b_db, {magic_bb_b_size});
+}
@@ -1,21 +0,0 @@
-/*
- * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
- *
- * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
- * General Public License as published by the Free Software Foundation, either version 3 of the
- * License, or (at your option) any later version.
- *
- * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
- * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
- * General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License along with this program. If not,
- * see <http://www.gnu.org/licenses/>.
-*/
-namespace kpk {
-
-extern void init();
-bool probe(int wk, int bk, int stm, int wp);
-
-}	// namespace kpk
-
@@ -12,6 +12,15 @@
  * You should have received a copy of the GNU General Public License along with this program. If not,
  * see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+#include "bitbase.h"
 #include "test.h"
 #include "psq.h"
 #include "eval.h"
@@ -20,22 +29,91 @@
 
 uint64_t dbg_cnt1 = 0, dbg_cnt2 = 0;
 
+namespace {
+
+// Start of the process, for the startup test. GCC runs the static initializers with a priority
+// before all the others (in any translation unit), so that their time is included.
+#if defined(__GNUC__)
+#define INIT_FIRST __attribute__((init_priority(101)))
+#else
+#define INIT_FIRST
+#endif
+const std::chrono::high_resolution_clock::time_point Start INIT_FIRST
+	= std::chrono::high_resolution_clock::now();
+
+bool is_epd(const char *arg)
+/* An EPD file argument is either an existing file, or anything that is not a number (so that a
+ * missing file is reported, rather than silently running the default tests) */
+{
+	return std::ifstream(arg) || arg[strspn(arg, "0123456789")];
+}
+
+std::string exe_dir(const char *argv0)
+/* Directory of the executable, with a trailing separator (empty when unknown). When the engine is
+ * found through the PATH, argv[0] has no directory: on Linux, /proc/self/exe is used instead. */
+{
+	std::string path = argv0;
+#if defined(__linux__)
+	char buf[4096];
+	const ssize_t n = readlink("/proc/self/exe", buf, sizeof(buf));
+	if (n > 0 && n < (ssize_t)sizeof(buf))
+		path.assign(buf, n);
+#endif
+	const size_t sep = path.find_last_of("/\\");
+	return sep == std::string::npos ? "" : path.substr(0, sep + 1);
+}
+
+}	// namespace
+
 int main (int argc, char **argv)
 {
+	using namespace std::chrono;
+
 	bb::init();
+	bitbase::init(exe_dir(argv[0]));
 	psq::init();
 	eval::init();
 
-	if (argc == 2) {
+	// test subcommands exit with 1 on failure
+	bool ok = true;
+	if (argc >= 2) {
+		// bench [depth [hash]]
 		if (std::string(argv[1]) == "bench")
-			bench(12);
-		else if (std::string(argv[1]) == "perft")
-			test_perft();
-		else if (std::string(argv[1]) == "see")
-			test_see();
+			bench(argc >= 3 ? atoi(argv[2]) : 12, argc >= 4 ? atoi(argv[3]) : 32);
+		else if (std::string(argv[1]) == "perft") {
+			// perft [file.epd] [threads [hash]]
+			int i = 2;
+			const char *epd = argc > i && is_epd(argv[i]) ? argv[i++] : nullptr;
+			const int threads = std::max(1, std::min(argc > i ? atoi(argv[i++]) : 1, 64));
+			const int hash = std::max(0, std::min(argc > i ? atoi(argv[i]) : 0, 1048576));
+			if (epd)
+				ok = test_perft_epd(epd, threads, hash);
+			else
+				ok = test_perft(threads, hash);
+		} else if (std::string(argv[1]) == "see")
+			ok = test_see();
+		else if (std::string(argv[1]) == "syzygy")
+			// syzygy [path]
+			ok = test_syzygy(argc >= 3 ? argv[2] : "");
+		else if (std::string(argv[1]) == "movesort")
+			bench_movesort();
+		else if (std::string(argv[1]) == "startup") {
+			// time from the start of the process, until it has answered "uci" (as uci::loop() does),
+			// and until the bitbases are ready (see bitbase::init())
+			uci::intro();
+			const auto uciok = high_resolution_clock::now();
+			std::cout << "cpu: " << bb::cpu_features() << '\n'
+				<< "uci: " << duration_cast<microseconds>(uciok - Start).count() << " us" << std::endl;
+			bitbase::wait();
+			std::cout << "bitbases: " << duration_cast<microseconds>(high_resolution_clock::now() - Start)
+				.count() << " us" << std::endl;
+		}
 
 		if (dbg_cnt1 || dbg_cnt2)
 			std::cout << dbg_cnt1 << '\n' << dbg_cnt2 << std::endl;
 	} else
 		uci::loop();
+
+	bitbase::stop();
+	return ok ? 0 : 1;
 }
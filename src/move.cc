@@ -18,6 +18,7 @@
 #include <sstream>
 #include <algorithm>
 #include "move.h"
+#include "movegen.h"
 #include "board.h"
 #include "psq.h"
 
@@ -45,7 +46,7 @@ int is_check(const board::Board& B, move_t m)
 	int kpos = B.get_king_pos(them);
 
 	// test discovered check
-	if ( (bb::test_bit(B.st().dcheckers, fsq))		// discovery checker
+	if ( (bb::test_bit(B.get_dcheckers(), fsq))		// discovery checker
 		 && (!bb::test_bit(bb::direction(kpos, fsq), tsq)))	// move out of its dc-ray
 		return 2;
 	// test direct check
@@ -109,6 +110,96 @@ bool is_pawn_threat(const board::Board& B, move_t m)
 	return false;
 }
 
+bool is_pseudo_legal(const board::Board& B, move_t m)
+/* Tests if m follows the rules of piece movement in B, ignoring self checks. Used to validate moves
+ * that do not come from the move generator (eg. TT moves, which can be garbage in case of a hash
+ * collision, or an entry written concurrently by another thread) */
+{
+	const int us = B.get_turn(), them = opp_color(us);
+	const int fsq = m.fsq(), tsq = m.tsq(), flag = m.flag();
+	const int piece = B.get_piece_on(fsq);
+
+	if (!m || B.get_color_on(fsq) != us || B.get_color_on(tsq) == us
+		|| B.get_piece_on(tsq) == KING)
+		return false;
+
+	// promotion bits must be clear unless m is a promotion (so that m compares equal to the same
+	// move coming from the move generator)
+	if (flag != PROMOTION) {
+		move_t tmp;
+		tmp.fsq(fsq);
+		tmp.tsq(tsq);
+		tmp.flag(flag);
+		if (tmp != m)
+			return false;
+	}
+
+	if (flag == CASTLING) {
+		if (piece != KING || B.is_check())
+			return false;
+		move_t mlist[2];
+		move_t *end = movegen::gen_castling(B, mlist);
+		return std::find(mlist, end, m) != end;
+	}
+
+	if (piece == PAWN) {
+		if ((flag == PROMOTION) != bb::test_bit(bb::eighth_rank(us), tsq))
+			return false;
+
+		if (flag == EN_PASSANT)
+			return tsq == B.st().epsq && bb::test_bit(bb::pattacks(us, fsq), tsq);
+		else if (bb::test_bit(bb::pattacks(us, fsq), tsq))
+			return B.get_color_on(tsq) == them;
+
+		// pushes: single, or double from the second rank
+		const int sq = bb::pawn_push(us, fsq);
+		if (bb::test_bit(B.st().occ, sq))
+			return false;
+		return tsq == sq
+			|| (bb::test_bit(bb::second_rank(us), fsq) && tsq == bb::pawn_push(us, sq)
+				&& !bb::test_bit(B.st().occ, tsq));
+	}
+
+	return flag == NORMAL && bb::test_bit(bb::piece_attack(piece, fsq, B.st().occ), tsq);
+}
+
+bool is_legal(const board::Board& B, move_t m)
+/* Tests if the pseudo-legal move m leaves our King in check, when B is not in check. Used for moves
+ * that do not come from the legal move generator: pseudo-legal generation (see movegen.h), and moves
+ * validated by is_pseudo_legal(). Castling is already fully tested by is_pseudo_legal(). */
+{
+	assert(!B.is_check() && is_pseudo_legal(B, m));
+	const int us = B.get_turn(), them = opp_color(us);
+	const int fsq = m.fsq(), tsq = m.tsq(), kpos = B.get_king_pos(us);
+
+	if (fsq == kpos) {
+		if (m.flag() == CASTLING)
+			return true;
+
+		// is tsq attacked, once our King has left fsq (sliders x-ray through fsq)?
+		Bitboard occ = B.st().occ;
+		bb::clear_bit(&occ, fsq);
+		return !(bb::pattacks(us, tsq) & B.get_pieces(them, PAWN))
+			&& !(bb::nattacks(tsq) & B.get_pieces(them, KNIGHT))
+			&& !(bb::kattacks(tsq) & B.get_pieces(them, KING))
+			&& !(bb::rattacks(tsq, occ) & B.get_RQ(them))
+			&& !(bb::battacks(tsq, occ) & B.get_BQ(them));
+	}
+
+	if (m.flag() == EN_PASSANT) {
+		// play the ep capture on occ, and test for check by a sliding enemy piece
+		Bitboard occ = B.st().occ;
+		bb::clear_bit(&occ, fsq);
+		bb::clear_bit(&occ, bb::pawn_push(them, tsq));
+		bb::set_bit(&occ, tsq);
+		return !(B.get_RQ(them) & bb::rattacks(kpos, occ)) && !(B.get_BQ(them) & bb::battacks(kpos, occ));
+	}
+
+	// only a piece on a line with our King can be pinned, and then it can only move along the pin ray
+	const Bitboard ray = bb::direction(kpos, fsq);
+	return !ray || !bb::test_bit(B.get_pinned(), fsq) || bb::test_bit(ray, tsq);
+}
+
 move_t string_to_move(const board::Board& B, const std::string& s)
 {
 	move_t m(0);
@@ -173,7 +264,8 @@ int see(const board::Board& B, move_t m)
 		capture = B.get_piece_on(fsq);
 
 	// If the opponent has no attackers we are finished
-	attackers = bb::test_bit(B.st().attacked, tsq) ? calc_attackers(B, tsq, occ) : 0;
+	attackers = bb::test_bit(B.get_attacks(opp_color(B.get_turn()), NO_PIECE), tsq)
+		? calc_attackers(B, tsq, occ) : 0;
 	stm = opp_color(stm);
 	stm_attackers = attackers & B.get_pieces(stm);
 	if (!stm_attackers)
@@ -60,6 +60,8 @@ enum { NO_CHECK, NORMAL_CHECK, DISCO_CHECK };
 extern int is_check(const board::Board& B, move_t m);
 extern bool is_cop(const board::Board& B, move_t m);	// capture or promotion
 extern bool is_pawn_threat(const board::Board& B, move_t m);
+extern bool is_pseudo_legal(const board::Board& B, move_t m);
+extern bool is_legal(const board::Board& B, move_t m);	// m must be pseudo-legal, and B not in check
 
 extern move_t string_to_move(const board::Board& B, const std::string& s);
 extern std::string move_to_string(move_t m);
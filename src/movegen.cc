@@ -18,16 +18,17 @@
 
 namespace {
 
-move::move_t *make_pawn_moves(const board::Board& B, int fsq, int tsq, move::move_t *mlist, bool sub_promotions)
-/* Centralise the pawnm moves generation: given (fsq,tsq) the rest follows. We filter here all the
- * indirect self checks (through fsq, or through the ep captured square) */
+move::move_t *make_pawn_moves(const board::Board& B, int fsq, int tsq, move::move_t *mlist,
+	bool sub_promotions, bool legal)
+/* Centralise the pawnm moves generation: given (fsq,tsq) the rest follows. If legal, we filter here
+ * all the indirect self checks (through fsq, or through the ep captured square) */
 {
 	assert(square_ok(fsq) && square_ok(tsq));
 	const int us = B.get_turn(), them = opp_color(us);
 	int kpos = B.get_king_pos(us);
 
 	// filter self check through fsq
-	if (bb::test_bit(B.st().pinned, fsq) && !bb::test_bit(bb::direction(kpos, fsq), tsq))
+	if (legal && bb::test_bit(B.get_pinned(), fsq) && !bb::test_bit(bb::direction(kpos, fsq), tsq))
 		return mlist;
 
 	move::move_t m;
@@ -36,15 +37,17 @@ move::move_t *make_pawn_moves(const board::Board& B, int fsq, int tsq, move::mov
 
 	if (tsq == B.st().epsq) {
 		m.flag(move::EN_PASSANT);
-		Bitboard occ = B.st().occ;
-		// play the ep capture on occ
-		bb::clear_bit(&occ, m.fsq());
-		bb::clear_bit(&occ, bb::pawn_push(them, m.tsq()));	// remove the ep captured enemy pawn
-		bb::set_bit(&occ, m.tsq());
-		// test for check by a sliding enemy piece
-		if ((B.get_RQ(them) & bb::rattacks(kpos) & bb::rattacks(kpos, occ))
-			|| (B.get_BQ(them) & bb::battacks(kpos) & bb::battacks(kpos, occ)))
-			return mlist;	// illegal move by indirect self check (through the ep captured pawn)
+		if (legal) {
+			Bitboard occ = B.st().occ;
+			// play the ep capture on occ
+			bb::clear_bit(&occ, m.fsq());
+			bb::clear_bit(&occ, bb::pawn_push(them, m.tsq()));	// remove the ep captured enemy pawn
+			bb::set_bit(&occ, m.tsq());
+			// test for check by a sliding enemy piece
+			if ((B.get_RQ(them) & bb::rattacks(kpos) & bb::rattacks(kpos, occ))
+				|| (B.get_BQ(them) & bb::battacks(kpos) & bb::battacks(kpos, occ)))
+				return mlist;	// illegal move by indirect self check (through the ep captured pawn)
+		}
 	} else
 		m.flag(move::NORMAL);
 
@@ -64,9 +67,10 @@ move::move_t *make_pawn_moves(const board::Board& B, int fsq, int tsq, move::mov
 	return mlist;
 }
 
-move::move_t *make_piece_moves(const board::Board& B, int fsq, Bitboard tss, move::move_t *mlist)
-/* Centralise the generation of a piece move: given (fsq,tsq) the rest follows. We filter indirect
- * self checks here. Note that direct self-checks aren't generated, so we don't check them here. In
+move::move_t *make_piece_moves(const board::Board& B, int fsq, Bitboard tss, move::move_t *mlist,
+	bool legal)
+/* Centralise the generation of a piece move: given (fsq,tsq) the rest follows. If legal, we filter
+ * indirect self checks here. Note that direct self-checks aren't generated, so we don't check them here. In
  * other words, we never put our King in check before calling this function */
 {
 	assert(square_ok(fsq));
@@ -76,7 +80,7 @@ move::move_t *make_piece_moves(const board::Board& B, int fsq, Bitboard tss, mov
 	m.fsq(fsq);
 	m.flag(move::NORMAL);
 
-	if (bb::test_bit(B.st().pinned, fsq))
+	if (legal && bb::test_bit(B.get_pinned(), fsq))
 		tss &= bb::direction(kpos, fsq);
 
 	while (tss) {
@@ -91,9 +95,11 @@ move::move_t *make_piece_moves(const board::Board& B, int fsq, Bitboard tss, mov
 
 namespace movegen {
 
-move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::move_t *mlist, bool king_moves)
+move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::move_t *mlist, bool king_moves,
+	bool legal)
 /* Generates piece moves, when the board is not in check. Uses targets to filter the tss, eg.
- * targets = ~friends (all moves), empty (quiet moves only), enemies (captures only). */
+ * targets = ~friends (all moves), empty (quiet moves only), enemies (captures only). If !legal, self
+ * checks are not filtered (see move::is_legal()). */
 {
 	assert(!king_moves || !B.is_check());	// do not use when in check (use gen_evasion)
 	const int us = B.get_turn();
@@ -105,7 +111,7 @@ move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::mov
 	while (fss) {
 		int fsq = bb::pop_lsb(&fss);
 		Bitboard tss = bb::nattacks(fsq) & targets;
-		mlist = make_piece_moves(B, fsq, tss, mlist);
+		mlist = make_piece_moves(B, fsq, tss, mlist, legal);
 	}
 
 	// Rook Queen moves
@@ -113,7 +119,7 @@ move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::mov
 	while (fss) {
 		int fsq = bb::pop_lsb(&fss);
 		Bitboard tss = targets & bb::rattacks(fsq, B.st().occ);
-		mlist = make_piece_moves(B, fsq, tss, mlist);
+		mlist = make_piece_moves(B, fsq, tss, mlist, legal);
 	}
 
 	// Bishop Queen moves
@@ -121,15 +127,17 @@ move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::mov
 	while (fss) {
 		int fsq = bb::pop_lsb(&fss);
 		Bitboard tss = targets & bb::battacks(fsq, B.st().occ);
-		mlist = make_piece_moves(B, fsq, tss, mlist);
+		mlist = make_piece_moves(B, fsq, tss, mlist, legal);
 	}
 
 	// King moves (king_moves == false is only used for check escapes)
 	if (king_moves) {
 		int fsq = B.get_king_pos(us);
 		// here we also filter direct self checks, which shouldn't be sent to serialize_moves
-		Bitboard tss = bb::kattacks(fsq) & targets & ~B.st().attacked;
-		mlist = make_piece_moves(B, fsq, tss, mlist);
+		Bitboard tss = bb::kattacks(fsq) & targets;
+		if (legal)
+			tss &= ~B.get_attacks(opp_color(us), NO_PIECE);
+		mlist = make_piece_moves(B, fsq, tss, mlist, legal);
 	}
 
 	return mlist;
@@ -142,6 +150,7 @@ move::move_t *gen_castling(const board::Board& B, move::move_t *mlist)
 {
 	assert(!B.is_check());
 	const int us = B.get_turn();
+	const Bitboard attacked = B.get_attacks(opp_color(us), NO_PIECE);
 
 	move::move_t m;
 	m.fsq(B.get_king_pos(us));
@@ -151,7 +160,7 @@ move::move_t *gen_castling(const board::Board& B, move::move_t *mlist)
 		Bitboard safe = 3ULL << (m.fsq() + 1);	// must not be attacked
 		Bitboard empty = safe;					// must be empty
 
-		if (!(B.st().attacked & safe) && !(B.st().occ & empty)) {
+		if (!(attacked & safe) && !(B.st().occ & empty)) {
 			m.tsq(m.fsq() + 2);
 			*mlist++ = m;
 		}
@@ -160,7 +169,7 @@ move::move_t *gen_castling(const board::Board& B, move::move_t *mlist)
 		Bitboard safe = 3ULL << (m.fsq() - 2);	// must not be attacked
 		Bitboard empty = safe | (1ULL << (m.fsq() - 3));	// must be empty
 
-		if (!(B.st().attacked & safe) && !(B.st().occ & empty)) {
+		if (!(attacked & safe) && !(B.st().occ & empty)) {
 			m.tsq(m.fsq() - 2);
 			*mlist++ = m;
 		}
@@ -170,7 +179,7 @@ move::move_t *gen_castling(const board::Board& B, move::move_t *mlist)
 }
 
 move::move_t *gen_pawn_moves(const board::Board& B, Bitboard targets, move::move_t *mlist,
-							 bool sub_promotions)
+							 bool sub_promotions, bool legal)
 /* Generates pawn moves, when the board is not in check. These are of course: double and single
  * pushes, normal captures, en passant captures. Promotions are considered in serialize_moves (so
  * for under-promotion pruning, modify only serialize_moves) */
@@ -209,14 +218,14 @@ move::move_t *gen_pawn_moves(const board::Board& B, Bitboard targets, move::move
 		const int tsq = bb::pop_lsb(&tss);
 
 		if (bb::test_bit(tss_sp, tsq))		// can we single push to tsq ?
-			mlist = make_pawn_moves(B, tsq - sp_inc, tsq, mlist, sub_promotions);
+			mlist = make_pawn_moves(B, tsq - sp_inc, tsq, mlist, sub_promotions, legal);
 		else if (bb::test_bit(tss_dp, tsq))	// can we double push to tsq ?
-			mlist = make_pawn_moves(B, tsq - dp_inc, tsq, mlist, sub_promotions);
+			mlist = make_pawn_moves(B, tsq - dp_inc, tsq, mlist, sub_promotions, legal);
 		else {	// can we capture tsq ?
 			if (bb::test_bit(tss_lc, tsq))	// can we left capture tsq ?
-				mlist = make_pawn_moves(B, tsq - lc_inc, tsq, mlist, sub_promotions);
+				mlist = make_pawn_moves(B, tsq - lc_inc, tsq, mlist, sub_promotions, legal);
 			if (bb::test_bit(tss_rc, tsq))	// can we right capture tsq ?
-				mlist = make_pawn_moves(B, tsq - rc_inc, tsq, mlist, sub_promotions);
+				mlist = make_pawn_moves(B, tsq - rc_inc, tsq, mlist, sub_promotions, legal);
 		}
 	}
 
@@ -237,7 +246,7 @@ move::move_t *gen_evasion(const board::Board& B, move::move_t *mlist)
 	Bitboard tss;
 
 	// normal king escapes
-	tss = bb::kattacks(kpos) & ~B.get_pieces(us) & ~B.st().attacked;
+	tss = bb::kattacks(kpos) & ~B.get_pieces(us) & ~B.get_attacks(opp_color(us), NO_PIECE);
 
 	// The king must also get out of all sliding checkers' firing lines
 	Bitboard _checkers = checkers;
@@ -249,7 +258,7 @@ move::move_t *gen_evasion(const board::Board& B, move::move_t *mlist)
 	}
 
 	// generate King escapes
-	mlist = make_piece_moves(B, kpos, tss, mlist);
+	mlist = make_piece_moves(B, kpos, tss, mlist, true);
 
 	if (!bb::several_bits(B.st().checkers)) {
 		// piece moves (only if we're not in double check)
@@ -268,7 +277,7 @@ move::move_t *gen_evasion(const board::Board& B, move::move_t *mlist)
 	return mlist;
 }
 
-move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist)
+move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist, bool legal)
 /* Generates non capturing checks by pieces (not pawns nor the king) */
 {
 	assert(!B.is_check());
@@ -281,7 +290,7 @@ move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist)
 	if (B.get_pieces(us, PAWN) & bb::nattacks(ksq) & bb::pawn_span(them, ksq)) {
 		tss = bb::pattacks(them, ksq) & ~occ;
 		if (tss)
-			mlist = gen_pawn_moves(B, tss, mlist, false);
+			mlist = gen_pawn_moves(B, tss, mlist, false, legal);
 	}
 
 	// Piece quiet checks (direct + discovered)
@@ -296,12 +305,12 @@ move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist)
 			// direct checks
 			tss = attacks & check_squares;
 			// revealed checks
-			if (bb::test_bit(B.st().dcheckers, fsq))
+			if (bb::test_bit(B.get_dcheckers(), fsq))
 				tss |= attacks & ~bb::direction(ksq, fsq);
 			// exclude captures
 			tss &= ~occ;
 
-			mlist = make_piece_moves(B, fsq, tss, mlist);
+			mlist = make_piece_moves(B, fsq, tss, mlist, legal);
 		}
 	}
 
@@ -328,5 +337,24 @@ move::move_t *gen_moves(const board::Board& B, move::move_t *mlist)
 	}
 }
 
+move::move_t *gen_pseudo_moves(const board::Board& B, move::move_t *mlist)
+/* Same as gen_moves(), except that self checks are not filtered when the board is not in check:
+ * move::is_legal() must be called on each move before playing it. This saves the legality tests of
+ * the moves that are never played (eg. after a cutoff). */
+{
+	if (B.is_check())
+		return gen_evasion(B, mlist);
+	else {
+		mlist = gen_castling(B, mlist);	// castling moves are always legal
+
+		const Bitboard targets = ~B.get_pieces(B.get_turn());
+
+		mlist = gen_piece_moves(B, targets, mlist, true, false);
+		mlist = gen_pawn_moves(B, targets, mlist, true, false);
+
+		return mlist;
+	}
+}
+
 }	// namespace movegen
 
@@ -26,12 +26,17 @@ struct move_t;
 
 namespace movegen {
 
-extern move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::move_t *mlist, bool king_moves);
+/* legal = false: pseudo-legal generation, self checks are not filtered (see move::is_legal()). Only
+ * when not in check: evasions are always legal. */
+extern move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::move_t *mlist, bool king_moves,
+	bool legal = true);
 extern move::move_t *gen_castling(const board::Board& B, move::move_t *mlist);
-extern move::move_t *gen_pawn_moves(const board::Board& B, Bitboard targets, move::move_t *mlist, bool sub_promotions);
+extern move::move_t *gen_pawn_moves(const board::Board& B, Bitboard targets, move::move_t *mlist, bool sub_promotions,
+	bool legal = true);
 extern move::move_t *gen_evasion(const board::Board& B, move::move_t *mlist);
-extern move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist);
+extern move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist, bool legal = true);
 extern move::move_t *gen_moves(const board::Board& B, move::move_t *mlist);
+extern move::move_t *gen_pseudo_moves(const board::Board& B, move::move_t *mlist);
 
 }	// namespace movegen
 
@@ -70,7 +70,7 @@ void Refutation::clear()
 
 MoveSort::MoveSort(const board::Board* _B, int _depth, const SearchInfo *_ss,
 				   const History *_H, const Refutation *_R)
-	: B(_B), ss(_ss), H(_H), R(_R), idx(0), depth(_depth)
+	: B(_B), ss(_ss), H(_H), R(_R), idx(0), count(0), depth(_depth), bad_cnt(0), special_cnt(0)
 {
 	type = depth > 0 ? GEN_ALL : (depth == 0 ? GEN_CAPTURES_CHECKS : GEN_CAPTURES);
 	/* If we're in check set type = ALL. This affects the sort() and uses SEE instead of MVV/LVA for
@@ -80,46 +80,143 @@ MoveSort::MoveSort(const board::Board* _B, int _depth, const SearchInfo *_ss,
 
 	refutation = R ? R->get_refutation(B->get_dm_key()) : move::move_t(0);
 
-	move::move_t mlist[MAX_MOVES];
-	count = generate(mlist) - mlist;
-	annotate(mlist);
+	/* Evasions are few, and the root needs the exact move count before searching (forced move), so
+	 * they generate all their moves at once. So does the qsearch (captures only, scored by MVV/LVA). */
+	// moves are generated pseudo-legal, except evasions, and at the root (see generate())
+	pseudo = !B->is_check() && (type != GEN_ALL || ss->ply > 0);
+
+	if (type == GEN_ALL && !B->is_check() && ss->ply > 0) {
+		stage = TT_MOVE;
+		if (move::is_pseudo_legal(*B, ss->best) && move::is_legal(*B, ss->best)) {
+			special[special_cnt++] = ss->best;
+			annotate(special, special + 1);
+		}
+	} else {
+		stage = ALL_MOVES;
+		move::move_t mlist[MAX_MOVES];
+		annotate(mlist, generate(mlist));
+	}
 }
 
 move::move_t *MoveSort::generate(move::move_t *mlist)
+/* Generates all the moves (stage == ALL_MOVES), or the moves of the current stage (CAPTURES or
+ * QUIETS). The captures include all promotions: the quiet moves are the rest. Moves are pseudo-legal,
+ * except at the root and in check (see next()). */
 {
-	if (type == GEN_ALL)
+	const int us = B->get_turn(), them = opp_color(us);
+
+	if (stage == QUIETS) {
+		assert(type == GEN_ALL && !B->is_check());
+		const Bitboard targets = ~B->st().occ;
+
+		mlist = movegen::gen_castling(*B, mlist);
+		mlist = movegen::gen_piece_moves(*B, targets, mlist, true, false);
+		return movegen::gen_pawn_moves(*B, targets & ~bb::eighth_rank(us) & ~B->st().epsq_bb(),
+			mlist, false, false);
+	} else if (type == GEN_ALL && stage != CAPTURES)
 		return movegen::gen_moves(*B, mlist);
 	else {
 		// If we are in check, then type must be ALL (see constructor)
 		assert(!B->is_check());
 
-		const int us = B->get_turn(), them = opp_color(us);
 		move::move_t *end = mlist;
 		Bitboard targets = B->get_pieces(them);
 
 		// Piece captures
 		if (targets & (B->get_attacks(us, KNIGHT) | B->get_attacks(us, BISHOP)
 					   | B->get_attacks(us, ROOK) | B->get_attacks(us, KING)))
-			end = movegen::gen_piece_moves(*B, targets, end, true);
+			end = movegen::gen_piece_moves(*B, targets, end, true, false);
 
-		// Pawn captures
+		// Pawn captures (and promotions, including under-promotions for GEN_ALL)
 		targets |= B->st().epsq_bb() | bb::eighth_rank(us);
 		if (targets & B->get_attacks(us, PAWN))
-			end = movegen::gen_pawn_moves(*B, targets, end, false);
+			end = movegen::gen_pawn_moves(*B, targets, end, type == GEN_ALL, false);
 
 		// Quiet checks
 		if (type == GEN_CAPTURES_CHECKS)
-			end = movegen::gen_quiet_checks(*B, end);
+			end = movegen::gen_quiet_checks(*B, end, false);
 
 		return end;
 	}
 }
 
-void MoveSort::annotate(const move::move_t *mlist)
+void MoveSort::generate_stage()
+/* Moves on to the next stage, and adds its moves to the list */
+{
+	if (stage == CAPTURES) {
+		// the captures left are the losing ones: they wait at the end of list (there is room, as
+		// the list never holds more than all the moves generated)
+		bad_cnt = count - idx;
+		std::copy_backward(&list[idx], &list[count], &list[MAX_MOVES]);
+		count = idx;
+	}
+
+	move::move_t mlist[MAX_MOVES], *end = mlist;
+
+	switch (++stage) {
+	case CAPTURES:
+	case QUIETS:
+		// except the special moves, already tried in the previous stages
+		end = std::remove_if(mlist, generate(mlist),
+			[this](move::move_t m) { return is_special(m); });
+		break;
+
+	case KILLERS: {
+		const move::move_t killers[3] = {ss->killer[0], ss->killer[1], refutation};
+		for (int i = 0; i < 3; ++i) {
+			const move::move_t m = killers[i];
+			if (!is_special(m) && move::is_pseudo_legal(*B, m) && !move::is_cop(*B, m)
+				&& move::is_legal(*B, m))
+				*end++ = special[special_cnt++] = m;
+		}
+		break;
+	}
+
+	case BAD_CAPTURES:
+		std::copy(&list[MAX_MOVES - bad_cnt], &list[MAX_MOVES], &list[count]);
+		count += bad_cnt;
+		return;
+	}
+
+	annotate(mlist, end);
+
+	if (stage == QUIETS)
+		sort_quiets();
+}
+
+void MoveSort::sort_quiets()
+/* Insertion sort of the quiet moves, by descending history. At depth <= 6, those with a negative
+ * history are not sorted: they end up after the others, but in no particular order (each swap moves
+ * one of them to the end). Most of them are pruned by move count pruning, or reduced (see search.cc),
+ * so their order hardly matters. */
+{
+	const int limit = depth <= 6 ? 0 : -INF;
+	Token *const begin = &list[idx], *const end = &list[count];
+
+	// [begin, sorted] is sorted
+	Token *sorted = begin;
+	for (Token *p = begin + 1; p < end; ++p)
+		if (p->score >= limit) {
+			const Token t = *p;
+			*p = *++sorted;
+
+			Token *q;
+			for (q = sorted; q != begin && *(q - 1) < t; --q)
+				*q = *(q - 1);
+			*q = t;
+		}
+}
+
+bool MoveSort::is_special(move::move_t m) const
 {
-	for (int i = idx; i < count; ++i) {
-		list[i].m = mlist[i];
-		score(&list[i]);
+	return std::find(special, special + special_cnt, m) != special + special_cnt;
+}
+
+void MoveSort::annotate(const move::move_t *mlist, const move::move_t *end)
+{
+	for (; mlist != end; ++mlist) {
+		list[count].m = *mlist;
+		score(&list[count++]);
 	}
 }
 
@@ -151,16 +248,38 @@ void MoveSort::score(MoveSort::Token *t)
 }
 
 move::move_t MoveSort::next(int *see)
+/* Selection depends on the stage: the quiet moves are already sorted, the others are short lists, where
+ * we pick the best. In the CAPTURES stage, only the winning and equal captures are picked. */
 {
-	if (idx < count) {
-		std::swap(list[idx], *std::max_element(&list[idx], &list[count]));
-		const Token& t = list[idx++];
-		*see = t.see == -INF
-			   ? move::see(*B, t.m)	// compute SEE
-			   : t.see;				// use SEE cache
-		return t.m;
-	} else
-		return move::move_t(0);
+	for (;;) {
+		while (idx < count) {
+			Token *best = &list[idx];
+			if (stage != QUIETS) {
+				best = std::max_element(&list[idx], &list[count]);
+				if (stage == CAPTURES && best->score < History::Max)
+					break;	// only losing captures left
+			}
+
+			// pseudo-legal moves are tested only now, when they are about to be searched (the TT move
+			// and the killers were tested when they were added)
+			if (pseudo && stage != TT_MOVE && stage != KILLERS && !move::is_legal(*B, best->m)) {
+				std::copy(best + 1, &list[count], best);	// preserve the order
+				--count;
+				continue;
+			}
+
+			std::swap(list[idx], *best);
+			const Token& t = list[idx++];
+			*see = t.see == -INF
+				   ? move::see(*B, t.m)	// compute SEE
+				   : t.see;				// use SEE cache
+			return t.m;
+		}
+
+		if (stage == BAD_CAPTURES || stage == ALL_MOVES)
+			return move::move_t(0);
+		generate_stage();
+	}
 }
 
 move::move_t MoveSort::previous()
@@ -66,6 +66,9 @@ private:
 	Entry r[count];
 };
 
+/* Move sorting, with staged generation at GEN_ALL nodes (not in check, and not at the root): the TT
+ * move is tried before any generation, then the captures (SEE >= 0), the killers and refutation, and
+ * only then are the quiet moves generated. Cut nodes that fail high early never generate the rest. */
 class MoveSort {
 public:
 	enum GenType {
@@ -89,11 +92,23 @@ public:
 	move::move_t next(int *see);
 	move::move_t previous();
 
+	/* Number of moves generated so far (not counting the illegal ones found by next()). It is the
+	 * number of legal moves once next() has returned 0, or from the start in check and at the root
+	 * (where moves are generated at once, and legal). */
 	int get_count() const {
 		return count;
 	}
 
 private:
+	enum Stage {
+		TT_MOVE,		// ss->best (TT or IID move), if legal
+		CAPTURES,		// captures and promotions with SEE >= 0, best first
+		KILLERS,		// killers and refutation, if legal (and still quiet)
+		QUIETS,			// quiet moves, sorted by history when generated (see sort_quiets())
+		BAD_CAPTURES,	// captures with SEE < 0, best first
+		ALL_MOVES		// not staged: all moves generated at once, best first
+	};
+
 	const board::Board *B;
 	GenType type;
 	const SearchInfo *ss;
@@ -104,8 +119,16 @@ private:
 	Token list[MAX_MOVES];
 	int idx, count, depth;
 
+	int stage;					// current stage: its moves are in list[idx..count)
+	bool pseudo;				// pseudo-legal generation: legality is tested in next()
+	int bad_cnt;				// bad captures, waiting at the end of list until BAD_CAPTURES
+	move::move_t special[4];	// TT move, killers and refutation (already in the list)
+	int special_cnt;
+
 	move::move_t *generate(move::move_t *mlist);
-	void annotate(const move::move_t *mlist);
+	void generate_stage();
+	void sort_quiets();
+	void annotate(const move::move_t *mlist, const move::move_t *end);
 	void score(MoveSort::Token *t);
+	bool is_special(move::move_t m) const;
 };
-
@@ -11,10 +11,21 @@
  *
  * You should have received a copy of the GNU General Public License along with this program. If not,
  * see <http://www.gnu.org/licenses/>.
+ *
+ * Credits:
+ * - Lazy SMP depth skipping pattern replicates what Stockfish does. Thanks to Marco Costalba and
+ * Joona Kiiski.
 */
+#include <algorithm>
 #include <chrono>
+#include <ctime>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
 #include "search.h"
+#include "bitbase.h"
+#include "syzygy.h"
 #include "uci.h"
 #include "eval.h"
 #include "psq.h"
@@ -26,60 +37,166 @@ using namespace std::chrono;
 namespace search {
 
 TTable TT;
-Refutation R;
 
 uint64_t node_count;
-uint64_t polling_frequency;
+std::atomic<bool> stop_signal(false), pondering(false);
 
 }	// namespace search
 
 namespace {
 
-bool can_abort, pondering;
-struct AbortSearch {};
-struct ForcedMove {};
+bool can_abort;
+std::atomic<bool> stop;		// set by the main thread when it's done, to stop the helper threads
 
 uint64_t node_limit;
-int time_limit[2], time_allowed;
-time_point<high_resolution_clock> start;
-
-History H;
+int time_limit[2];		// soft and hard limits (see TimeManager), 0 = no time limit
+int time_allowed;		// the search is aborted beyond it
+bool fixed_time;		// movetime: the time manager is not used
+bool infinite;			// go infinite: search until "stop"
+int64_t start;	// see now()
+
+// Origin of the time budget: the start of the search, or the "ponderhit" (see search::ponderhit())
+std::atomic<int64_t> budget_start;
+
+/* The main thread checks the limits about every PollTime ms: the number of nodes between two checks
+ * is calibrated on its speed so far (see node_poll()). Helper threads only check the stop flag. */
+const int PollTime = 1;
+const uint64_t MinPollNodes = 64, MaxPollNodes = 1 << 16, HelperPollNodes = 1024;
+
+int64_t now()
+/* Monotonic time in ms. On Linux, the coarse clock is much cheaper to read (no TSC read, no
+ * conversion), but its resolution is the kernel tick: use it only if that is fine enough. */
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+	static const clockid_t Clock = []() {
+		timespec res;
+		return !clock_getres(CLOCK_MONOTONIC_COARSE, &res) && !res.tv_sec
+			&& res.tv_nsec <= PollTime * 1000000 ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC;
+	}();
+
+	timespec ts;
+	clock_gettime(Clock, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+#else
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
 
 // Formulas tuned by CLOP
 int razor_margin(int depth)	  { return 73 * depth + 145; }
 int eval_margin(int depth)	  { return 37 * depth + 111; }
 int null_reduction(int depth) { return (13 * depth + 72) / 32; }
 
+// Lazy eval margin in qsearch: |full eval - material and PSQ| exceeds it for only 0.005% of nodes
+// (endgames that are scaled or recognized are excluded, see eval::lazy_eval())
+const int LazyMargin = 400;
+
 int DrawScore[NB_COLOR];	// Contempt draw score by color
 int TTPrunePVPly;			// TT pruning at PV nodes after this ply
 
-move::move_t pv[MAX_PLY+1][MAX_PLY+1];
-move::move_t best_move, ponder_move;
-bool best_move_changed;
+// Syzygy tablebases: TB wins are scored just below the mate range, so they are not confused with
+// real mates, minus the ply where the TB win is found (like mates, see score_to_tt()), so the search
+// prefers a mate, or else a shorter path to a TB win
+const int TBWin = MATE - MAX_PLY - 1;
+int TBCardinality;						// probe positions with up to this number of pieces
+std::vector<move::move_t> RootMoves;	// root moves preserving the DTZ outcome (when probed)
+
+/* Lazy SMP: each thread runs its own iterative deepening on its own copy of the board, with its own
+ * search stack and move ordering tables. Threads only cooperate through the shared TT. The main
+ * thread (id = 0) is the only one that handles time, input and output, and its best move is the one
+ * that is played. */
+class Worker {
+public:
+	explicit Worker(int _id): id(_id), nodes(0) {
+		R.clear();
+	}
+
+	void iterate(board::Board& B, int max_depth);
+	uint64_t get_nodes() const {
+		return nodes.load(std::memory_order_relaxed);
+	}
 
-void node_poll()
+	const int id;
+	board::Board pos;	// private copy of the root position (helper threads only)
+	Refutation R;
+	move::move_t best_move, ponder_move;
+
+private:
+	std::atomic<uint64_t> nodes;
+	SearchInfo stack[MAX_PLY + 1];
+	History H;
+	move::move_t pv[MAX_PLY+1][MAX_PLY+1];
+	bool best_move_changed;
+	uint64_t best_move_nodes;	// root nodes spent on the best move, in the current iteration
+	uint64_t next_poll;	// node count of the next node_poll() check
+
+	/* Set by node_poll() when the search must stop (or at the root, on a forced move). Every node
+	 * then returns at once, and its callers discard the score: nothing is stored in the TT, nor in
+	 * the move sorting tables, and the root keeps the best move of the last completed searches. */
+	bool aborted;
+
+	void node_poll();
+	int qsearch(board::Board& B, int alpha, int beta, int depth, int node_type, SearchInfo *ss);
+	void update_killers(const board::Board& B, SearchInfo *ss);
+	int pvs(board::Board& B, int alpha, int beta, int depth, int node_type, SearchInfo *ss);
+};
+
+std::vector<std::unique_ptr<Worker>> Workers;
+
+uint64_t total_nodes()
 {
-	if (!(++search::node_count & (search::polling_frequency - 1)) && can_abort) {
-		bool abort = false;
-
-		// node limit reached ?
-		if (node_limit && search::node_count >= node_limit)
-			abort = true;
-		// time limit reached ?
-		else if (time_allowed && duration_cast<milliseconds>
-				 (high_resolution_clock::now() - start).count() > time_allowed)
-			abort = true;
-
-		// limit reached: abort search, unless we're pondering
-		if (abort && !pondering)
-			throw AbortSearch();
-
-		// handle input during search
-		std::string token = uci::check_input();
-		if (token == "stop")
-			throw AbortSearch();
-		else if (token == "ponderhit")
-			pondering = false;
+	uint64_t result = 0;
+	for (auto& w : Workers)
+		result += w->get_nodes();
+	return result;
+}
+
+bool skip_depth(int id, int depth)
+/* Helper threads skip some iterations, so that they don't all search the same depth as the main
+ * thread. Each helper skips blocks of SkipSize[i] iterations, with a phase shift of SkipPhase[i] */
+{
+	static const int SkipSize[20]  = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+	static const int SkipPhase[20] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+	assert(id > 0);
+	const int i = (id - 1) % 20;
+	return ((depth + SkipPhase[i]) / SkipSize[i]) % 2;
+}
+
+void Worker::node_poll()
+{
+	// single writer: no need for an atomic increment
+	const uint64_t n = nodes.load(std::memory_order_relaxed) + 1;
+	nodes.store(n, std::memory_order_relaxed);
+
+	if (n < next_poll)
+		return;
+
+	// helper threads only need to know when the main thread is done
+	if (id) {
+		next_poll = n + HelperPollNodes;
+		aborted = stop;
+		return;
+	}
+
+	// schedule the next check PollTime ms from now, at our speed so far, but not beyond the node
+	// limit (shared by all threads)
+	const int64_t elapsed = now() - start;
+	uint64_t interval = elapsed > 0 ? n * PollTime / elapsed : MinPollNodes;
+	interval = std::max(MinPollNodes, std::min(interval, MaxPollNodes));
+	const uint64_t total = node_limit ? total_nodes() : 0;
+	if (node_limit && total < node_limit)
+		interval = std::min(interval, (node_limit - total) / Workers.size() + 1);
+	next_poll = n + interval;
+
+	if (can_abort) {
+		// node limit or time limit reached ?
+		const bool abort = (node_limit && total >= node_limit)
+			|| (time_allowed && now() - budget_start > time_allowed);
+
+		// limit reached: abort search, unless we're pondering. "stop" and "ponderhit" are read by the
+		// I/O thread, which only sets the flags (see uci.cc).
+		aborted = (abort && !search::pondering) || search::stop_signal;
 	}
 }
 
@@ -102,18 +219,28 @@ int mate_in(int ply)
 int score_to_tt(int score, int ply)
 /* mate scores from the search, must be adjusted to be written in the TT. For example, if we find a
  * mate in 10 plies from the current position, it will be scored mate_in(15) by the search and must
- * be entered mate_in(10) in the TT */
+ * be entered mate_in(10) in the TT. Same for TB wins, which also depend on the ply. */
 {
-	return score >= mate_in(MAX_PLY) ? score + ply :
-		   score <= mated_in(MAX_PLY) ? score - ply : score;
+	return score >= TBWin - MAX_PLY ? score + ply :
+		   score <= -TBWin + MAX_PLY ? score - ply : score;
 }
 
 int score_from_tt(int tt_score, int ply)
 /* mate scores from the TT need to be adjusted. For example, if we find a mate in 10 in the TT at
  * ply 5, then we effectively have a mate in 15 plies (from the root) */
 {
-	return tt_score >= mate_in(MAX_PLY) ? tt_score - ply :
-		   tt_score <= mated_in(MAX_PLY) ? tt_score + ply : tt_score;
+	return tt_score >= TBWin - MAX_PLY ? tt_score - ply :
+		   tt_score <= -TBWin + MAX_PLY ? tt_score + ply : tt_score;
+}
+
+const TTable::Entry *tt_probe(const board::Board& B, Key key, TTable::Entry *copy)
+/* TT lookup. The TT move is discarded if it isn't pseudo-legal, so the search never sees a garbage
+ * move coming from a hash collision, or from an entry written concurrently by another thread. */
+{
+	const TTable::Entry *tte = search::TT.probe(key, copy);
+	if (tte && tte->move && !move::is_pseudo_legal(B, tte->move))
+		copy->move = move::move_t(0);
+	return tte;
 }
 
 bool can_return_tt(bool is_pv, const TTable::Entry *tte, int depth, int beta, int ply)
@@ -138,7 +265,12 @@ bool can_return_tt(bool is_pv, const TTable::Entry *tte, int depth, int beta, in
 
 void time_alloc(const search::Limits& sl, int result[2])
 {
-	if (sl.movetime > 0)
+	fixed_time = sl.movetime > 0;
+	result[0] = result[1] = 0;
+
+	if (sl.infinite)
+		return;
+	else if (sl.movetime > 0)
 		result[0] = result[1] = sl.movetime;
 	else if (sl.time > 0 || sl.inc > 0) {
 		int movestogo = sl.movestogo > 0 ? sl.movestogo : 30;
@@ -147,7 +279,59 @@ void time_alloc(const search::Limits& sl, int result[2])
 	}
 }
 
-int qsearch(board::Board& B, int alpha, int beta, int depth, int node_type, SearchInfo *ss)
+/* Decides, after each iteration of the main thread, whether to start the next one. The soft limit
+ * is scaled by how settled the search looks: the best move has been stable for a few iterations,
+ * the score doesn't drop, and the best move takes most of the root nodes. The next iteration is not
+ * started if it is predicted to finish beyond the hard limit, where it would be aborted, and its
+ * time wasted. After a ponderhit, the limits apply to the time used since then, but the pondering
+ * time still counts to predict the iterations. */
+class TimeManager {
+public:
+	void clear() {
+		stable = 0;
+		last_score = INF;
+		last_elapsed = last_duration = 0;
+	}
+
+	// elapsed: since the start of the search, used: since the start of the time budget
+	// best_share: fraction of the root nodes of this iteration spent on the best move
+	bool next_iteration(int elapsed, int used, int score, bool best_move_changed, double best_share,
+		bool recapture);
+
+private:
+	int stable;			// number of iterations with the same best move
+	int last_score;
+	int last_elapsed, last_duration;
+};
+
+bool TimeManager::next_iteration(int elapsed, int used, int score, bool best_move_changed,
+	double best_share, bool recapture)
+{
+	stable = best_move_changed ? 0 : stable + 1;
+	const int drop = last_score == INF ? 0 : std::max(0, std::min(last_score - score, 120));
+	last_score = score;
+
+	// duration of the next iteration, from the growth of the last two
+	const int duration = elapsed - last_elapsed;
+	const double growth = last_duration > 0
+		? std::max(1.5, std::min(double(duration) / last_duration, 4.0)) : 2.0;
+	last_elapsed = elapsed;
+	last_duration = duration;
+
+	double target = time_limit[0];
+	target *= best_move_changed ? 1.6 : stable >= 4 ? 0.6 : stable >= 2 ? 0.8 : 1.0;
+	target *= 1.0 + drop / 120.0;
+	target *= 1.6 - best_share;
+	if (recapture)
+		target /= 2;
+
+	return used < std::min(target, double(time_limit[1]))
+		&& used + duration * growth <= time_limit[1];
+}
+
+TimeManager TM;
+
+int Worker::qsearch(board::Board& B, int alpha, int beta, int depth, int node_type, SearchInfo *ss)
 {
 	assert(depth <= 0);
 	assert(alpha < beta && (node_type == PV || alpha + 1 == beta));
@@ -155,6 +339,8 @@ int qsearch(board::Board& B, int alpha, int beta, int depth, int node_type, Sear
 	const Key key = B.get_key();
 	search::TT.prefetch(key);
 	node_poll();
+	if (aborted)
+		return 0;
 
 	const bool in_check = B.is_check();
 	int best_score = -INF, old_alpha = alpha;
@@ -166,19 +352,34 @@ int qsearch(board::Board& B, int alpha, int beta, int depth, int node_type, Sear
 	if (B.is_draw())
 		return DrawScore[B.get_turn()];
 
-	const Bitboard hanging = hanging_pieces(B);
-
 	// TT lookup
-	const TTable::Entry *tte = search::TT.probe(key);
+	TTable::Entry tt_copy;
+	const TTable::Entry *tte = tt_probe(B, key, &tt_copy);
 	if (tte) {
 		if (can_return_tt(node_type == PV, tte, depth, beta, ss->ply)) {
-			search::TT.refresh(tte);
+			search::TT.refresh(key);
 			return score_from_tt(tte->score, ss->ply);
 		}
 		ss->eval = tte->eval;
 		ss->best = tte->move;
-	} else
+	}
+
+	// computed after the TT cutoff, as it forces the (lazy) attack calculation
+	const Bitboard hanging = hanging_pieces(B);
+
+	if (!tte) {
+		// Lazy eval: if material and PSQ alone are far above beta, the stand pat will fail high, so
+		// don't bother with the full eval. This returns before the TT store, so the approximate
+		// eval is never stored. Return the lower bound of the eval, not the estimate itself.
+		int lazy;
+		if (!in_check && !ss->null_child && node_type != PV && eval::lazy_eval(B, &lazy)) {
+			lazy += eval::asymmetric_eval(B, hanging);
+			if (lazy - LazyMargin >= beta)
+				return lazy - LazyMargin;
+		}
+
 		ss->eval = in_check ? -INF : (ss->null_child ? -(ss - 1)->eval : eval::symmetric_eval(B));
+	}
 
 	// stand pat score
 	int stand_pat = ss->eval + eval::asymmetric_eval(B, hanging);
@@ -237,6 +438,8 @@ int qsearch(board::Board& B, int alpha, int beta, int depth, int node_type, Sear
 			B.play(ss->m);
 			score = -qsearch(B, -beta, -alpha, depth - 1, -node_type, ss + 1);
 			B.undo();
+			if (aborted)
+				return 0;
 		}
 
 		if (score > best_score) {
@@ -267,7 +470,7 @@ int qsearch(board::Board& B, int alpha, int beta, int depth, int node_type, Sear
 	return best_score;
 }
 
-void update_killers(const board::Board& B, SearchInfo *ss)
+void Worker::update_killers(const board::Board& B, SearchInfo *ss)
 {
 	// update killers on a LIFO basis
 	if (ss->killer[0] != ss->best) {
@@ -276,10 +479,10 @@ void update_killers(const board::Board& B, SearchInfo *ss)
 	}
 
 	// update double move refutation hash table
-	search::R.set_refutation(B.get_dm_key(), ss->best);
+	R.set_refutation(B.get_dm_key(), ss->best);
 }
 
-int pvs(board::Board& B, int alpha, int beta, int depth, int node_type, SearchInfo *ss)
+int Worker::pvs(board::Board& B, int alpha, int beta, int depth, int node_type, SearchInfo *ss)
 {
 	assert(alpha < beta && (node_type == PV || alpha + 1 == beta));
 
@@ -293,6 +496,8 @@ int pvs(board::Board& B, int alpha, int beta, int depth, int node_type, SearchIn
 		pv[ss->ply][0] = move::move_t(0);
 
 	node_poll();
+	if (aborted)
+		return 0;
 
 	const bool root = !ss->ply, in_check = B.is_check();
 	const int old_alpha = alpha;
@@ -310,28 +515,58 @@ int pvs(board::Board& B, int alpha, int beta, int depth, int node_type, SearchIn
 		return alpha;
 	}
 
-	const Bitboard hanging = hanging_pieces(B);
-
 	// TT lookup
-	const TTable::Entry *tte = search::TT.probe(key);
+	TTable::Entry tt_copy;
+	const TTable::Entry *tte = tt_probe(B, key, &tt_copy);
 	if (tte) {
 		if (!root && can_return_tt(node_type == PV, tte, depth, beta, ss->ply)) {
 			// Refresh TT entry to prevent ageing
-			search::TT.refresh(tte);
+			search::TT.refresh(key);
 
 			// update killers, refutation, and history on TT prune when alpha is raised
 			if (tte->score > old_alpha && (ss->best = tte->move) && !move::is_cop(B, ss->best)) {
 				update_killers(B, ss);
-				H.add(B, ss->best, (depth * depth) >> (hanging != 0));
+				H.add(B, ss->best, (depth * depth) >> (hanging_pieces(B) != 0));
 			}
 
 			return score_from_tt(tte->score, ss->ply);
 		}
 		ss->eval = tte->eval;
 		ss->best = tte->move;
-	} else
+	}
+
+	// Tablebase probe: only right after a capture or pawn move, as the WDL tables ignore the 50
+	// move counter. The WDL score is a bound or an exact score, depending on the outcome. This is
+	// done before the eval, which is not needed on a cutoff: the TT entry then gets the TB score as
+	// its eval, unless the eval is already known.
+	const int piece_cnt = bb::count_bit(B.st().occ);
+	int wdl;
+	if ( !root && piece_cnt <= TBCardinality
+		 && (piece_cnt < TBCardinality || depth >= uci::SyzygyProbeDepth)
+		 && !B.st().rule50 && !B.st().crights
+		 && syzygy::probe_wdl(B, &wdl) ) {
+		const int score = wdl < syzygy::BLESSED_LOSS ? -TBWin + ss->ply
+			: wdl > syzygy::CURSED_WIN ? TBWin - ss->ply
+			: DrawScore[B.get_turn()] + wdl;
+		const int bound = wdl < syzygy::BLESSED_LOSS ? All
+			: wdl > syzygy::CURSED_WIN ? Cut : PV;
+
+		if ( bound == PV
+			 || (bound == Cut && score >= beta)
+			 || (bound == All && score <= alpha) ) {
+			const int eval = tte ? ss->eval : (in_check ? -INF : score);
+			search::TT.store(key, bound, std::min(MAX_DEPTH, depth + 6),
+							 score_to_tt(score, ss->ply), eval, move::move_t(0));
+			return score;
+		}
+	}
+
+	if (!tte)
 		ss->eval = in_check ? -INF : (ss->null_child ? -(ss - 1)->eval : eval::symmetric_eval(B));
 
+	// computed after the TT cutoff, as it forces the (lazy) attack calculation
+	const Bitboard hanging = hanging_pieces(B);
+
 	// Stand pat score: adjust for assymetric eval, and using tte->score (when possible)
 	int stand_pat = ss->eval + eval::asymmetric_eval(B, hanging);
 	if (tte) {
@@ -356,6 +591,8 @@ int pvs(board::Board& B, int alpha, int beta, int depth, int node_type, SearchIn
 		const int threshold = beta - razor_margin(depth);
 		if (stand_pat < threshold) {
 			const int score = qsearch(B, threshold - 1, threshold, 0, All, ss + 1);
+			if (aborted)
+				return 0;
 			if (score < threshold)
 				return score;
 		}
@@ -381,6 +618,8 @@ int pvs(board::Board& B, int alpha, int beta, int depth, int node_type, SearchIn
 		const int score = -pvs(B, -beta, -alpha, depth - reduction, All, ss + 1);
 		(ss + 1)->null_child = (ss + 1)->skip_null = false;
 		B.undo();
+		if (aborted)
+			return 0;
 
 		if (score >= beta)	// null search fails high
 			return score < mate_in(MAX_PLY)
@@ -402,13 +641,20 @@ tt_skip_null:
 		ss->skip_null = true;
 		pvs(B, alpha, beta, node_type == PV ? depth - 2 : depth / 2, node_type, ss);
 		ss->skip_null = false;
+		if (aborted)
+			return 0;
 	}
 
-	MoveSort MS(&B, depth, ss, &H, &search::R);
-	const move::move_t refutation = search::R.get_refutation(B.get_dm_key());
+	MoveSort MS(&B, depth, ss, &H, &R);
+	const move::move_t refutation = R.get_refutation(B.get_dm_key());
 
 	int cnt = 0, LMR = 0, see;
 	while ( alpha < beta && (ss->m = MS.next(&see)) ) {
+		// at the root, only search the moves that preserve the tablebase outcome
+		if (root && !RootMoves.empty()
+			&& std::find(RootMoves.begin(), RootMoves.end(), ss->m) == RootMoves.end())
+			continue;
+
 		++cnt;
 		const int check = move::is_check(B, ss->m);
 
@@ -417,8 +663,9 @@ tt_skip_null:
 		if (check && (check == move::DISCO_CHECK || see >= 0) )
 			// extend relevant checks
 			new_depth = depth;
-		else if (MS.get_count() == 1)
-			// extend forced replies
+		else if (in_check && MS.get_count() == 1)
+			// extend forced replies (the move count is only known in advance for evasions, see
+			// MoveSort)
 			new_depth = depth;
 		else
 			new_depth = depth - 1;
@@ -476,6 +723,7 @@ tt_skip_null:
 			}
 		}
 
+		const uint64_t nodes_before = get_nodes();
 		B.play(ss->m);
 
 		// PVS
@@ -506,6 +754,8 @@ tt_skip_null:
 		}
 
 		B.undo();
+		if (aborted)
+			return 0;
 
 		if (score > best_score) {
 			best_score = score;
@@ -528,6 +778,7 @@ tt_skip_null:
 					best_move = ss->m;
 				}
 				ponder_move = pv[ss->ply][1];
+				best_move_nodes = get_nodes() - nodes_before;
 			}
 		}
 	}
@@ -536,9 +787,11 @@ tt_skip_null:
 		// mated or stalemated
 		assert(!root);
 		return in_check ? mated_in(ss->ply) : DrawScore[B.get_turn()];
-	} else if (root && MS.get_count() == 1 && can_abort && !pondering)
+	} else if (root && MS.get_count() == 1 && !id && can_abort && !search::pondering && !infinite) {
 		// forced move at the root node, play instantly and prevent further iterative deepening
-		throw ForcedMove();
+		aborted = true;
+		return best_score;
+	}
 
 	// update TT
 	node_type = best_score <= old_alpha ? All : best_score >= beta ? Cut : PV;
@@ -562,85 +815,62 @@ tt_skip_null:
 	return best_score;
 }
 
-}	// namespace
-
-namespace search {
-
-std::pair<move::move_t, move::move_t> bestmove(board::Board& B, const Limits& sl)
-// returns a pair (best move, ponder move)
+void Worker::iterate(board::Board& B, int max_depth)
 {
-	start = high_resolution_clock::now();
-
-	SearchInfo ss[MAX_PLY + 1];
 	for (int ply = 0; ply <= MAX_PLY; ++ply)
-		ss[ply].clear(ply);
-
-	node_count = 0;
-	node_limit = sl.nodes;
-	pondering = sl.ponder;
-	time_alloc(sl, time_limit);
+		stack[ply].clear(ply);
 
+	nodes = 0;
 	best_move = ponder_move = move::move_t(0);
-	best_move_changed = false;
-
+	best_move_changed = aborted = false;
+	next_poll = 0;
 	H.clear();
-	TT.new_search();
-	B.set_root();	// remember root node, for correct 2/3-fold in is_draw()
-
-	// Calculate the value of a draw by chess rules, for both colors (contempt option)
-	const int us = B.get_turn(), them = opp_color(us);
-	DrawScore[us] = uci::Analyze ? 0 : -uci::Contempt;
-	DrawScore[them] = uci::Analyze ? 0 : uci::Contempt;
-	
-	// TT pruning at PV nodes:
-	// only when play >= , to have a ponder move.
-	// no pruning in analyse mode, to print untruncated PVs.
-	TTPrunePVPly = uci::Analyze ? MAX_PLY : 2;
 
 	uci::info ui;
 	ui.pv = pv[0];
-	
-	const int max_depth = sl.depth ? std::min(MAX_DEPTH, sl.depth) : MAX_DEPTH;
-	
+
+	if (!id) {
+		TM.clear();
+		time_allowed = time_limit[1];
+	}
+
 	// iterative deepening loop
-	for (int depth = 1, alpha = -INF, beta = +INF; depth <= max_depth; depth++) {		
+	for (int depth = 1, alpha = -INF, beta = +INF; depth <= max_depth; depth++) {
+		if (id && skip_depth(id, depth))
+			continue;
+
 		ui.clear();
 		ui.depth = depth;
 
-		// We can only abort the search once iteration 1 is finished. In extreme situations (eg.
-		// fixed nodes), the SearchLimits sl could trigger a search abortion before that, which is
-		// disastrous, as the best move could be illegal or completely stupid.
-		can_abort = depth >= 2;
-
 		int delta = 16;
 
-		// Time allowance
-		time_allowed = time_limit[best_move_changed];
-		if (best_move && move::see(B, best_move) > 0)
-			time_allowed /= 2;
+		if (!id) {
+			// We can only abort the search once iteration 1 is finished. In extreme situations (eg.
+			// fixed nodes), the SearchLimits sl could trigger a search abortion before that, which is
+			// disastrous, as the best move could be illegal or completely stupid.
+			can_abort = depth >= 2;
+		}
 
 		best_move_changed = false;
+		uint64_t iteration_nodes;
 		for (;;) {
 			// Aspiration loop
 
-			try {
-				ui.score = pvs(B, alpha, beta, depth, PV, ss);
-			} catch (AbortSearch e) {
-				goto return_pair;
-			} catch (ForcedMove e) {
-				best_move = ss->best;
-				goto return_pair;
-			}
+			// best_move_nodes only covers the last (re-)search, so compare it to that one only
+			iteration_nodes = get_nodes();
+			ui.score = pvs(B, alpha, beta, depth, PV, stack);
+			if (aborted)
+				return;
 
-			ui.nodes = node_count;
-			ui.time = duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+			ui.nodes = total_nodes();
+			ui.time = now() - start;
 
 			if (alpha < ui.score && ui.score < beta) {
 				// score is within bounds
 				ui.bound = uci::info::EXACT;
-				
+
 				// set aspiration window for the next depth (so aspiration starts at depth 5)
-				if (depth >= 4 && !is_mate_score(ui.score)) {					
+				if (depth >= 4 && !is_mate_score(ui.score)) {
 					alpha = ui.score - delta;
 					beta = ui.score + delta;
 				}
@@ -651,31 +881,132 @@ std::pair<move::move_t, move::move_t> bestmove(board::Board& B, const Limits& sl
 				if (ui.score <= alpha) {
 					alpha -= delta;
 					ui.bound = uci::info::UBOUND;
-					std::cout << ui << std::endl;
 				} else if (ui.score >= beta) {
 					beta += delta;
 					ui.bound = uci::info::LBOUND;
-					std::cout << ui << std::endl;
 				}
 				delta *= 2;
 
-				// increase time_allowed, to try to finish the current depth iteration
-				time_allowed = time_limit[1];
+				if (!id) {
+					std::lock_guard<std::mutex> lock(uci::IoMutex);
+					std::cout << ui << std::endl;
+				}
+			}
+		}
+
+		if (!id) {
+			{
+				std::lock_guard<std::mutex> lock(uci::IoMutex);
+				std::cout << ui << std::endl;
+			}
+
+			// Time management: stop here, rather than start an iteration that is not worth it
+			if (time_limit[0] && !fixed_time && can_abort) {
+				const double best_share = double(best_move_nodes)
+					/ std::max<uint64_t>(get_nodes() - iteration_nodes, 1);
+				const bool recapture = best_move && move::see(B, best_move) > 0;
+				if (!TM.next_iteration(ui.time, now() - budget_start, ui.score, best_move_changed,
+						best_share, recapture) && !search::pondering)
+					return;
 			}
 		}
+	}
+}
+
+void init_workers()
+{
+	if (Workers.size() == (size_t)uci::Threads)
+		return;
+
+	Workers.clear();
+	for (int i = 0; i < uci::Threads; ++i)
+		Workers.push_back(std::unique_ptr<Worker>(new Worker(i)));
+}
+
+}	// namespace
 
-		std::cout << ui << std::endl;
+namespace search {
+
+std::pair<move::move_t, move::move_t> bestmove(board::Board& B, const Limits& sl)
+// returns a pair (best move, ponder move)
+{
+	budget_start = start = now();
+	infinite = sl.infinite;
+
+	node_limit = sl.nodes;
+	time_alloc(sl, time_limit);
+
+	// The bitbases generated in the background (see bitbase::init()) were missing in the previous
+	// searches: the TT and the eval cache may hold draws scored as wins, so they are cleared once.
+	static bool bitbases_ready = bitbase::ready();
+	if (!bitbases_ready && bitbase::ready()) {
+		bitbases_ready = true;
+		TT.clear(std::thread::hardware_concurrency());
+		eval::clear_eval_cache();
+	}
+
+	init_workers();
+	TT.new_search();
+	B.set_root();	// remember root node, for correct 2/3-fold in is_draw()
+
+	// Calculate the value of a draw by chess rules, for both colors (contempt option)
+	const int us = B.get_turn(), them = opp_color(us);
+	DrawScore[us] = uci::Analyze ? 0 : -uci::Contempt;
+	DrawScore[them] = uci::Analyze ? 0 : uci::Contempt;
+	
+	// TT pruning at PV nodes:
+	// only when play >= , to have a ponder move.
+	// no pruning in analyse mode, to print untruncated PVs.
+	TTPrunePVPly = uci::Analyze ? MAX_PLY : 2;
+
+	// Tablebases: when the root position is in the tables, restrict the search to the moves that
+	// preserve the DTZ outcome, and don't probe WDL again in the search (it would return the same
+	// score everywhere)
+	TBCardinality = std::min(syzygy::MaxPieces, uci::SyzygyProbeLimit);
+	RootMoves.clear();
+	if ( bb::count_bit(B.st().occ) <= TBCardinality && !B.st().crights
+		 && syzygy::root_moves(B, RootMoves) )
+		TBCardinality = 0;
+
+	const int max_depth = sl.depth ? std::min(MAX_DEPTH, sl.depth) : MAX_DEPTH;
+
+	// start helper threads, each on its own copy of the board
+	stop = false;
+	std::vector<std::thread> helpers;
+	for (size_t i = 1; i < Workers.size(); ++i) {
+		Worker *w = Workers[i].get();
+		w->pos = B;
+		helpers.push_back(std::thread(&Worker::iterate, w, std::ref(w->pos), max_depth));
 	}
 
-return_pair:
-	return std::make_pair(best_move, ponder_move);
+	Workers[0]->iterate(B, max_depth);
+
+	// main thread is done: stop the helpers
+	stop = true;
+	for (auto& t : helpers)
+		t.join();
+
+	// "go infinite" or "go ponder" (even if the search reached MAX_DEPTH): the best move is only sent
+	// after "stop", or "ponderhit"
+	while ((infinite || pondering) && !stop_signal)
+		std::this_thread::sleep_for(milliseconds(1));
+
+	node_count = total_nodes();
+	return std::make_pair(Workers[0]->best_move, Workers[0]->ponder_move);
+}
+
+void ponderhit()
+{
+	budget_start = now();
+	pondering = false;
 }
 
 void clear_state()
 {
-	TT.clear();
-	R.clear();
+	init_workers();
+	TT.clear(std::thread::hardware_concurrency());
+	for (auto& w : Workers)
+		w->R.clear();
 }
 
 }	// namespace search
-
@@ -13,25 +13,34 @@
  * see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <atomic>
 #include "movesort.h"
 #include "tt.h"
 
 namespace search {
 
 struct Limits {
-	Limits(): time(0), inc(0), movetime(0), depth(0), movestogo(0), nodes(0), ponder(false) {}
+	Limits(): time(0), inc(0), movetime(0), depth(0), movestogo(0), nodes(0), ponder(false),
+		infinite(false) {}
 	int time, inc, movetime, depth, movestogo;
 	uint64_t nodes;
-	bool ponder;
+	bool ponder, infinite;
 };
 
 extern TTable TT;
 
 extern uint64_t node_count;
-extern uint64_t polling_frequency;	// must be a power of two
+
+/* bestmove() runs on the search thread, while the I/O thread reads the input (see uci.cc). "stop"
+ * sets stop_signal, and "ponderhit" calls ponderhit(). Both flags are set before starting the
+ * search. With "go ponder" or "go infinite", bestmove() only returns after "stop" or "ponderhit". */
+extern std::atomic<bool> stop_signal, pondering;
 
 std::pair<move::move_t, move::move_t> bestmove(board::Board& B, const Limits& sl);
 
+// Clears pondering: the time budget starts now, and the pondering time is kept (see search.cc)
+extern void ponderhit();
+
 extern void clear_state();
 
 }	// namespace search
@@ -0,0 +1,1228 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * Credits:
+ * - Syzygy tablebases, and their file format, are the work of Ronald de Man.
+ * - The probing code follows the structure of the Stockfish implementation, by Marco Costalba and
+ * Ronald de Man.
+*/
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include "syzygy.h"
+#include "movegen.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else   // assume POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int TBPIECES = 7;		// largest tables that can be probed
+const int MAX_DTZ = 1 << 18;
+
+enum { WDL_TABLE, DTZ_TABLE };
+
+// Probe state: CHANGE_STM means that a DTZ table only stores the other side to move.
+// ZEROING_BEST_MOVE means that the best move zeroes the 50 move counter (capture or pawn move).
+enum { FAIL, OK, CHANGE_STM, ZEROING_BEST_MOVE };
+
+// Table header flags, and per table flags
+enum { SPLIT = 1, HAS_PAWNS = 2 };
+enum { STM = 1, MAPPED = 2, WIN_PLIES = 4, LOSS_PLIES = 8, WIDE = 16, SINGLE_VALUE = 128 };
+
+const uint8_t Magic[2][4] = {
+	{ 0xD7, 0x66, 0x0C, 0xA5 },		// WDL (.rtbw)
+	{ 0x71, 0xE8, 0x23, 0x5D }		// DTZ (.rtbz)
+};
+
+// Encoding tables (see init_encoding())
+int MapPawns[NB_SQUARE];
+int MapB1H1H7[NB_SQUARE];
+int MapA1D1D4[NB_SQUARE];
+int MapKK[10][NB_SQUARE];
+int Binomial[6][NB_SQUARE];
+int LeadPawnIdx[6][NB_SQUARE];
+int LeadPawnsSize[6][4];
+
+// Numbers are stored little endian, except the compressed data, which is read as a big endian bit
+// stream. Pointers into the mapped files are not aligned, so we always read byte by byte.
+uint16_t read_le16(const uint8_t *p) { return p[0] | p[1] << 8; }
+uint32_t read_le32(const uint8_t *p) { return read_le16(p) | (uint32_t)read_le16(p + 2) << 16; }
+uint32_t read_be32(const uint8_t *p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+uint64_t read_be64(const uint8_t *p) { return (uint64_t)read_be32(p) << 32 | read_be32(p + 4); }
+
+const uint8_t *align(const uint8_t *p, uintptr_t n)
+{
+	return (const uint8_t *)(((uintptr_t)p + n - 1) & ~(n - 1));
+}
+
+// Pieces are coded as in the tables: White pawn..king = 1..6, Black pawn..king = 9..14
+int tb_piece(int color, int piece) { return 8 * color + piece + 1; }
+
+int off_a1h8(int sq) { return rank(sq) - file(sq); }
+
+bool pawns_comp(int sq1, int sq2) { return MapPawns[sq1] < MapPawns[sq2]; }
+
+/* Decompression data for one table (one side to move, and one file of the leading pawn). Values
+ * are compressed with "recursive pairing": symbols are pairs of symbols, down to the leaves which
+ * hold the values. The symbols themselves are Huffman coded (canonical code), in blocks of
+ * sizeof_block bytes. */
+struct PairsData {
+	int flags;
+	int max_sym_len, min_sym_len;
+	size_t sizeof_block, span, num_blocks;
+	const uint8_t *lowest_sym;		// uint16_t[], lowest symbol of each length
+	const uint8_t *btree;			// 3 bytes per symbol: left and right child (12 bits each)
+	const uint8_t *block_length;	// uint16_t[]: number of values in each block, minus one
+	size_t block_length_size;
+	const uint8_t *sparse_index;	// 6 bytes per entry: block (32 bits) and offset (16 bits)
+	size_t sparse_index_size;
+	const uint8_t *data;
+	std::vector<uint64_t> base64;	// lowest code of each length, left aligned on 64 bits
+	std::vector<uint8_t> symlen;	// number of values in each symbol, minus one
+
+	int pieces[TBPIECES];
+	uint64_t group_idx[TBPIECES + 1];
+	int group_len[TBPIECES + 1];
+	uint16_t map_idx[4];	// DTZ only: offset of the value maps for each WDL result
+
+	int left(int sym) const {
+		const uint8_t *p = btree + 3 * sym;
+		return (p[1] & 0xF) << 8 | p[0];
+	}
+	int right(int sym) const {
+		const uint8_t *p = btree + 3 * sym;
+		return p[2] << 4 | p[1] >> 4;
+	}
+};
+
+struct MappedFile {
+	MappedFile(): base(nullptr), size(0) {}
+	~MappedFile() { unmap(); }
+	bool map(const std::string& name);
+	void unmap();
+
+	const uint8_t *base;
+	size_t size;
+};
+
+struct Table {
+	std::string name;
+	Key key, key2;		// material key with the stronger side (listed first in name) as White / Black
+	int piece_count;
+	bool has_pawns, has_unique_pieces;
+	int pawn_count[2];	// leading color first
+
+	MappedFile mapped[2];		// WDL and DTZ
+	PairsData items[2][2][4];	// [table][side to move][leading pawn file]
+	const uint8_t *dtz_map;
+
+	explicit Table(const std::string& code);
+	bool load(int type, const std::string& path);
+};
+
+std::vector<std::unique_ptr<Table>> Tables;
+std::unordered_map<Key, Table *> TableByKey;
+
+void MappedFile::unmap()
+{
+	if (!base)
+		return;
+#if defined(_WIN32) || defined(_WIN64)
+	UnmapViewOfFile(base);
+#else
+	munmap((void *)base, size);
+#endif
+	base = nullptr;
+	size = 0;
+}
+
+bool MappedFile::map(const std::string& name)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	HANDLE fd = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+							FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (fd == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD size_high;
+	DWORD size_low = GetFileSize(fd, &size_high);
+	HANDLE fm = CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr);
+	CloseHandle(fd);
+	if (!fm)
+		return false;
+
+	base = (const uint8_t *)MapViewOfFile(fm, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(fm);
+	size = (uint64_t)size_high << 32 | size_low;
+#else
+	const int fd = open(name.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	fstat(fd, &st);
+	size = st.st_size;
+	void *p = size ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	base = p == MAP_FAILED ? nullptr : (const uint8_t *)p;
+#endif
+	return base != nullptr;
+}
+
+Key material_key(const std::string& code, int first_color)
+// code is eg. "KRPvKN": the first side (KRP) has color first_color
+{
+	Key key = 0;
+	int color = first_color;
+	for (char c : code) {
+		if (c == 'v')
+			color = opp_color(color);
+		else
+			key += 1ULL << (8 * board::PieceLabel[WHITE].find(c) + 4 * color);
+	}
+	return key;
+}
+
+Table::Table(const std::string& code): name(code), dtz_map(nullptr)
+{
+	key = material_key(code, WHITE);
+	key2 = material_key(code, BLACK);
+
+	int count[NB_COLOR][NB_PIECE] = {};
+	int color = WHITE;
+	for (char c : code) {
+		if (c == 'v')
+			color = BLACK;
+		else
+			++count[color][board::PieceLabel[WHITE].find(c)];
+	}
+
+	piece_count = code.size() - 1;
+	has_pawns = count[WHITE][PAWN] || count[BLACK][PAWN];
+
+	has_unique_pieces = false;
+	for (int c = WHITE; c <= BLACK; ++c)
+		for (int p = PAWN; p < KING; ++p)
+			if (count[c][p] == 1)
+				has_unique_pieces = true;
+
+	// The leading color is the one with fewer pawns (but some), for better compression
+	const bool lead = !count[BLACK][PAWN]
+		|| (count[WHITE][PAWN] && count[BLACK][PAWN] >= count[WHITE][PAWN]);
+	pawn_count[0] = count[lead ? WHITE : BLACK][PAWN];
+	pawn_count[1] = count[lead ? BLACK : WHITE][PAWN];
+}
+
+void set_groups(const Table& t, PairsData *d, const int order[2], int f)
+/* Pieces are encoded in groups (leading pieces, remaining pawns, then identical pieces). Calculates
+ * the length of each group, and the factor of each group in the index. */
+{
+	int n = 0, first_len = t.has_pawns ? 0 : t.has_unique_pieces ? 3 : 2;
+	d->group_len[n] = 1;
+
+	for (int i = 1; i < t.piece_count; ++i)
+		if (--first_len > 0 || d->pieces[i] == d->pieces[i - 1])
+			d->group_len[n]++;
+		else
+			d->group_len[++n] = 1;
+
+	d->group_len[++n] = 0;	// zero terminated
+
+	// The groups are not encoded in their natural order: order[0] is the position of the leading
+	// group, and order[1] the one of the remaining pawns (when both sides have pawns).
+	const bool pp = t.has_pawns && t.pawn_count[1];
+	int next = pp ? 2 : 1;
+	int free_squares = 64 - d->group_len[0] - (pp ? d->group_len[1] : 0);
+	uint64_t idx = 1;
+
+	for (int k = 0; next < n || k == order[0] || k == order[1]; ++k)
+		if (k == order[0]) {
+			d->group_idx[0] = idx;
+			idx *= t.has_pawns ? LeadPawnsSize[d->group_len[0]][f]
+				: t.has_unique_pieces ? 31332 : 462;
+		} else if (k == order[1]) {
+			d->group_idx[1] = idx;
+			idx *= Binomial[d->group_len[1]][48 - d->group_len[0]];
+		} else {
+			d->group_idx[next] = idx;
+			idx *= Binomial[d->group_len[next]][free_squares];
+			free_squares -= d->group_len[next++];
+		}
+
+	d->group_idx[n] = idx;
+}
+
+int set_symlen(PairsData *d, int s, std::vector<bool>& visited)
+{
+	visited[s] = true;	// the tree is acyclic
+	const int sr = d->right(s);
+	if (sr == 0xFFF)
+		return 0;
+
+	const int sl = d->left(s);
+	if (!visited[sl])
+		d->symlen[sl] = set_symlen(d, sl, visited);
+	if (!visited[sr])
+		d->symlen[sr] = set_symlen(d, sr, visited);
+
+	return d->symlen[sl] + d->symlen[sr] + 1;
+}
+
+const uint8_t *set_sizes(PairsData *d, const uint8_t *data, const uint8_t *end)
+/* Reads the sizes of d, and its Huffman code. Returns where the next PairsData starts, or nullptr
+ * if the file is too short, or the values are out of range. */
+{
+	if (end - data < 2)
+		return nullptr;
+
+	d->flags = *data++;
+
+	if (d->flags & SINGLE_VALUE) {
+		d->num_blocks = d->span = d->block_length_size = d->sparse_index_size = 0;
+		d->min_sym_len = *data++;	// the single value
+		return data;
+	}
+
+	// the last group_idx[] is the size of the table
+	int n = 0;
+	while (d->group_len[n])
+		++n;
+	const uint64_t tb_size = d->group_idx[n];
+
+	if (end - data < 9 || data[0] > 32 || data[1] > 32)
+		return nullptr;
+	d->sizeof_block = 1ULL << *data++;
+	d->span = 1ULL << *data++;
+	d->sparse_index_size = (tb_size + d->span - 1) / d->span;
+	const int padding = *data++;
+	d->num_blocks = read_le32(data);
+	data += 4;
+	d->block_length_size = d->num_blocks + padding;
+	d->max_sym_len = *data++;
+	d->min_sym_len = *data++;
+	d->lowest_sym = data;
+
+	// Canonical Huffman code: longer codes have lower values. base64[i] is the lowest code of
+	// length min_sym_len + i, left aligned on 64 bits, so that base64[i] >= base64[i + 1].
+	const int lengths = d->max_sym_len - d->min_sym_len + 1;
+	if ( !d->min_sym_len || lengths <= 0 || lengths > 64 - d->min_sym_len
+		 || end - data < 2 * lengths + 2 )
+		return nullptr;
+	d->base64.assign(lengths, 0);
+	for (int i = lengths - 2; i >= 0; --i)
+		d->base64[i] = (d->base64[i + 1] + read_le16(d->lowest_sym + 2 * i)
+						- read_le16(d->lowest_sym + 2 * (i + 1))) / 2;
+	for (int i = 0; i < lengths; ++i)
+		d->base64[i] <<= 64 - i - d->min_sym_len;
+
+	data += 2 * lengths;
+	d->symlen.assign(read_le16(data), 0);
+	data += 2;
+	d->btree = data;
+	if ((uint64_t)(end - data) < 3 * d->symlen.size() + (d->symlen.size() & 1))
+		return nullptr;
+
+	// symbols are pairs of lower symbols, except the leaves (right = 0xFFF)
+	for (size_t s = 0; s < d->symlen.size(); ++s)
+		if ( d->right(s) != 0xFFF
+			 && ((size_t)d->left(s) >= d->symlen.size() || (size_t)d->right(s) >= d->symlen.size()) )
+			return nullptr;
+
+	std::vector<bool> visited(d->symlen.size());
+	for (size_t s = 0; s < d->symlen.size(); ++s)
+		if (!visited[s])
+			d->symlen[s] = set_symlen(d, s, visited);
+
+	return data + 3 * d->symlen.size() + (d->symlen.size() & 1);
+}
+
+bool Table::load(int type, const std::string& path)
+{
+	const std::string ext = type == WDL_TABLE ? ".rtbw" : ".rtbz";
+	MappedFile& mf = mapped[type];
+	if (!mf.map(path + name + ext))
+		return false;
+
+	auto corrupted = [&]() {
+		std::cout << "info string corrupted tablebase file " << name << ext << std::endl;
+		mf.unmap();
+		return false;
+	};
+
+	// valid tables have a size of 16 modulo 64, and start with the magic number, and the layout
+	// flags of the material in their name
+	const uint8_t *data = mf.base + 4, *end = mf.base + mf.size;
+	if ( mf.size % 64 != 16 || std::memcmp(mf.base, Magic[type], 4)
+		 || has_pawns != bool(*data & HAS_PAWNS) || (key != key2) != bool(*data & SPLIT) )
+		return corrupted();
+	++data;
+
+	// DTZ tables only store one side to move
+	const int sides = type == WDL_TABLE && key != key2 ? 2 : 1;
+	const int max_file = has_pawns ? FILE_D : FILE_A;
+	const bool pp = has_pawns && pawn_count[1];
+
+	// All the offsets below come from the file: check them against its size before using them
+	if (end - data < (max_file + 1) * (1 + pp + piece_count))
+		return corrupted();
+
+	for (int f = FILE_A; f <= max_file; ++f) {
+		const int order[2][2] = {
+			{ *data & 0xF, pp ? *(data + 1) & 0xF : 0xF },
+			{ *data >> 4, pp ? *(data + 1) >> 4 : 0xF }
+		};
+		data += 1 + pp;
+
+		for (int k = 0; k < piece_count; ++k, ++data)
+			for (int i = 0; i < sides; ++i)
+				items[type][i][f].pieces[k] = i ? *data >> 4 : *data & 0xF;
+
+		for (int i = 0; i < sides; ++i)
+			set_groups(*this, &items[type][i][f], order[i], f);
+	}
+
+	data = align(data, 2);
+
+	for (int f = FILE_A; f <= max_file; ++f)
+		for (int i = 0; i < sides; ++i)
+			if (!(data = set_sizes(&items[type][i][f], data, end)))
+				return corrupted();
+
+	if (type == DTZ_TABLE) {
+		// maps from stored values to DTZ, by WDL result
+		dtz_map = data;
+		for (int f = FILE_A; f <= max_file; ++f) {
+			PairsData& d = items[type][0][f];
+			if (!(d.flags & MAPPED))
+				continue;
+
+			if (d.flags & WIDE) {
+				data = align(data, 2);
+				for (int i = 0; i < 4; ++i) {
+					if (end - data < 2)
+						return corrupted();
+					d.map_idx[i] = (data - dtz_map) / 2 + 1;
+					data += 2 * read_le16(data) + 2;
+				}
+			} else
+				for (int i = 0; i < 4; ++i) {
+					if (end - data < 1)
+						return corrupted();
+					d.map_idx[i] = data - dtz_map + 1;
+					data += *data + 1;
+				}
+		}
+		data = align(data, 2);
+	}
+
+	for (int f = FILE_A; f <= max_file; ++f)
+		for (int i = 0; i < sides; ++i) {
+			PairsData& d = items[type][i][f];
+			if (data > end || (uint64_t)(end - data) < 6 * d.sparse_index_size)
+				return corrupted();
+			d.sparse_index = data;
+			data += 6 * d.sparse_index_size;
+		}
+
+	for (int f = FILE_A; f <= max_file; ++f)
+		for (int i = 0; i < sides; ++i) {
+			PairsData& d = items[type][i][f];
+			if ((uint64_t)(end - data) < 2 * d.block_length_size)
+				return corrupted();
+			d.block_length = data;
+			data += 2 * d.block_length_size;
+		}
+
+	for (int f = FILE_A; f <= max_file; ++f)
+		for (int i = 0; i < sides; ++i) {
+			PairsData& d = items[type][i][f];
+			data = align(data, 64);
+			if (data > end || (uint64_t)(end - data) < (uint64_t)d.num_blocks * d.sizeof_block)
+				return corrupted();
+			d.data = data;
+			data += d.num_blocks * d.sizeof_block;
+		}
+
+	return true;
+}
+
+int decompress_pairs(const PairsData *d, uint64_t idx)
+{
+	if (d->flags & SINGLE_VALUE)
+		return d->min_sym_len;
+
+	// The sparse index gives, for every span values, the block and the offset in that block of the
+	// value in the middle of the span. From there, walk the blocks to find the one containing idx.
+	const uint32_t k = idx / d->span;
+	uint32_t block = read_le32(d->sparse_index + 6 * k);
+	int offset = read_le16(d->sparse_index + 6 * k + 4);
+	offset += int(idx % d->span) - int(d->span / 2);
+
+	while (offset < 0)
+		offset += read_le16(d->block_length + 2 * --block) + 1;
+	while (offset > read_le16(d->block_length + 2 * block))
+		offset -= read_le16(d->block_length + 2 * block++) + 1;
+
+	// Decode the Huffman symbols of the block, until we reach the one containing our value
+	const uint8_t *ptr = d->data + block * d->sizeof_block;
+	uint64_t buf64 = read_be64(ptr);
+	ptr += 8;
+	int buf64_size = 64;
+	int sym;
+
+	for (;;) {
+		int len = 0;	// symbol length - min_sym_len
+		while (buf64 < d->base64[len])
+			++len;
+
+		sym = (buf64 - d->base64[len]) >> (64 - len - d->min_sym_len);
+		sym += read_le16(d->lowest_sym + 2 * len);
+
+		if (offset < d->symlen[sym] + 1)
+			break;
+
+		offset -= d->symlen[sym] + 1;
+		len += d->min_sym_len;
+		buf64 <<= len;
+		buf64_size -= len;
+
+		if (buf64_size <= 32) {
+			buf64_size += 32;
+			buf64 |= (uint64_t)read_be32(ptr) << (64 - buf64_size);
+			ptr += 4;
+		}
+	}
+
+	// Expand the pairs, down to the leaf holding our value
+	while (d->symlen[sym]) {
+		const int left = d->left(sym);
+		if (offset < d->symlen[left] + 1)
+			sym = left;
+		else {
+			offset -= d->symlen[left] + 1;
+			sym = d->right(sym);
+		}
+	}
+
+	return d->left(sym);
+}
+
+bool encode(const board::Board& B, const Table& t, int type, const PairsData **pd, uint64_t *index)
+/* Index of B in the table t (of the material of B), and the PairsData it belongs to. Returns false
+ * when t is a DTZ table that does not store the side to move. */
+{
+	const Key mat_key = B.st().mat_key;
+
+	// Tables are for the stronger side as White. When it is Black, or when both sides have the same
+	// material and Black is to move, swap the colors and flip the board.
+	const bool symmetric_btm = t.key == t.key2 && B.get_turn() == BLACK;
+	const bool flip = symmetric_btm || mat_key != t.key;
+	const int flip_color = flip ? 8 : 0, flip_squares = flip ? 56 : 0;
+	const int stm = flip ^ B.get_turn();
+
+	int squares[TBPIECES], pieces[TBPIECES];
+	int size = 0, lead_pawns_cnt = 0, tb_file = FILE_A;
+	Bitboard b, lead_pawns = 0;
+
+	// Pawn tables are split by the file of the leading pawn: the one with the largest MapPawns[]
+	// (closest to the edge, then lowest rank)
+	if (t.has_pawns) {
+		const int pc = t.items[type][0][0].pieces[0] ^ flip_color;
+		lead_pawns = b = B.get_pieces(pc >> 3, PAWN);
+		do
+			squares[size++] = bb::pop_lsb(&b) ^ flip_squares;
+		while (b);
+
+		lead_pawns_cnt = size;
+		std::swap(squares[0], *std::max_element(squares, squares + lead_pawns_cnt, pawns_comp));
+		tb_file = std::min(file(squares[0]), FILE_H - file(squares[0]));
+	}
+
+	// DTZ tables only store one side to move
+	if (type == DTZ_TABLE && (t.items[type][0][tb_file].flags & STM) != stm
+		&& !(t.key == t.key2 && !t.has_pawns))
+		return false;
+
+	b = B.st().occ ^ lead_pawns;
+	do {
+		const int sq = bb::pop_lsb(&b);
+		squares[size] = sq ^ flip_squares;
+		pieces[size++] = tb_piece(B.get_color_on(sq), B.get_piece_on(sq)) ^ flip_color;
+	} while (b);
+
+	const PairsData *d = *pd = &t.items[type][type == WDL_TABLE ? stm : 0][tb_file];
+
+	// reorder the pieces as in the table
+	for (int i = lead_pawns_cnt; i < size - 1; ++i)
+		for (int j = i + 1; j < size; ++j)
+			if (d->pieces[i] == pieces[j]) {
+				std::swap(pieces[i], pieces[j]);
+				std::swap(squares[i], squares[j]);
+				break;
+			}
+
+	// the leading piece must be on files A..D
+	if (file(squares[0]) > FILE_D)
+		for (int i = 0; i < size; ++i)
+			squares[i] = file_mirror(squares[i]);
+
+	uint64_t idx;
+	if (t.has_pawns) {
+		idx = LeadPawnIdx[lead_pawns_cnt][squares[0]];
+		std::stable_sort(squares + 1, squares + lead_pawns_cnt, pawns_comp);
+		for (int i = 1; i < lead_pawns_cnt; ++i)
+			idx += Binomial[i][MapPawns[squares[i]]];
+	} else {
+		// without pawns, the leading piece must also be on ranks 1..4, and below the A1-H8 diagonal
+		if (rank(squares[0]) > RANK_4)
+			for (int i = 0; i < size; ++i)
+				squares[i] = rank_mirror(squares[i]);
+
+		for (int i = 0; i < d->group_len[0]; ++i) {
+			if (!off_a1h8(squares[i]))
+				continue;
+			if (off_a1h8(squares[i]) > 0)
+				for (int j = i; j < size; ++j)
+					squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+			break;
+		}
+
+		if (t.has_unique_pieces) {
+			// encode the leading 3 pieces together
+			const int adjust1 = squares[1] > squares[0];
+			const int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+
+			if (off_a1h8(squares[0]))
+				idx = (MapA1D1D4[squares[0]] * 63 + (squares[1] - adjust1)) * 62
+					+ squares[2] - adjust2;
+			else if (off_a1h8(squares[1]))
+				idx = (6 * 63 + rank(squares[0]) * 28 + MapB1H1H7[squares[1]]) * 62
+					+ squares[2] - adjust2;
+			else if (off_a1h8(squares[2]))
+				idx = 6 * 63 * 62 + 4 * 28 * 62
+					+ rank(squares[0]) * 7 * 28
+					+ (rank(squares[1]) - adjust1) * 28
+					+ MapB1H1H7[squares[2]];
+			else
+				idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28
+					+ rank(squares[0]) * 7 * 6
+					+ (rank(squares[1]) - adjust1) * 6
+					+ (rank(squares[2]) - adjust2);
+		} else
+			// only encode the kings
+			idx = MapKK[MapA1D1D4[squares[0]]][squares[1]];
+	}
+
+	// encode the remaining groups
+	idx *= d->group_idx[0];
+	int *group_sq = squares + d->group_len[0];
+	bool remaining_pawns = t.has_pawns && t.pawn_count[1];
+
+	for (int next = 1; d->group_len[next]; ++next) {
+		std::stable_sort(group_sq, group_sq + d->group_len[next]);
+		uint64_t n = 0;
+
+		// skip the squares occupied by the previous groups
+		for (int i = 0; i < d->group_len[next]; ++i) {
+			int adjust = 0;
+			for (int *sq = squares; sq < group_sq; ++sq)
+				adjust += group_sq[i] > *sq;
+			n += Binomial[i + 1][group_sq[i] - adjust - 8 * remaining_pawns];
+		}
+
+		remaining_pawns = false;
+		idx += n * d->group_idx[next];
+		group_sq += d->group_len[next];
+	}
+
+	*index = idx;
+	return true;
+}
+
+int probe_table(const board::Board& B, int type, int wdl, int *state)
+/* Probes the WDL or DTZ table for B (without captures). For DTZ, wdl is the WDL result of B. */
+{
+	// KvK
+	if (B.st().occ == B.get_K())
+		return 0;
+
+	auto it = TableByKey.find(B.st().mat_key);
+	if (it == TableByKey.end() || !it->second->mapped[type].base) {
+		*state = FAIL;
+		return 0;
+	}
+	const Table& t = *it->second;
+
+	const PairsData *d;
+	uint64_t idx;
+	if (!encode(B, t, type, &d, &idx)) {
+		*state = CHANGE_STM;
+		return 0;
+	}
+
+	int value = decompress_pairs(d, idx);
+
+	if (type == WDL_TABLE)
+		return value - 2;
+
+	// DTZ: map the stored value, and convert moves to plies where needed
+	static const int WDLMap[] = { 1, 3, 0, 2, 0 };
+	const int flags = d->flags;
+
+	if (flags & MAPPED) {
+		const int i = d->map_idx[WDLMap[wdl + 2]] + value;
+		value = flags & WIDE ? read_le16(t.dtz_map + 2 * i) : t.dtz_map[i];
+	}
+
+	if ( (wdl == syzygy::WIN && !(flags & WIN_PLIES))
+		 || (wdl == syzygy::LOSS && !(flags & LOSS_PLIES))
+		 || wdl == syzygy::CURSED_WIN || wdl == syzygy::BLESSED_LOSS )
+		value *= 2;
+
+	return value + 1;
+}
+
+bool is_capture(const board::Board& B, move::move_t m)
+{
+	return B.get_piece_on(m.tsq()) != NO_PIECE || m.flag() == move::EN_PASSANT;
+}
+
+bool is_mate(board::Board& B)
+{
+	move::move_t mlist[MAX_MOVES];
+	return B.is_check() && movegen::gen_moves(B, mlist) == mlist;
+}
+
+int search(board::Board& B, int *state, bool check_zeroing)
+/* WDL of B, resolving captures (and pawn moves if check_zeroing) by search, as the tables do not
+ * store positions where a capture is the best move (nor ep rights). */
+{
+	move::move_t mlist[MAX_MOVES];
+	move::move_t *end = movegen::gen_moves(B, mlist);
+	const int total = end - mlist;
+	int value, best = syzygy::LOSS, count = 0;
+
+	for (move::move_t *m = mlist; m != end; ++m) {
+		if (!is_capture(B, *m) && (!check_zeroing || B.get_piece_on(m->fsq()) != PAWN))
+			continue;
+
+		++count;
+		B.play(*m);
+		value = -search(B, state, false);
+		B.undo();
+
+		if (*state == FAIL)
+			return syzygy::DRAW;
+
+		if (value > best) {
+			best = value;
+			if (value >= syzygy::WIN) {
+				*state = ZEROING_BEST_MOVE;
+				return value;
+			}
+		}
+	}
+
+	// if all legal moves have been searched, the table value (which could be wrong, eg. with ep
+	// rights) is not needed
+	const bool no_more_moves = count && count == total;
+	if (no_more_moves)
+		value = best;
+	else {
+		value = probe_table(B, WDL_TABLE, 0, state);
+		if (*state == FAIL)
+			return syzygy::DRAW;
+	}
+
+	if (best >= value) {
+		*state = best > syzygy::DRAW || no_more_moves ? ZEROING_BEST_MOVE : OK;
+		return best;
+	}
+
+	*state = OK;
+	return value;
+}
+
+int dtz_before_zeroing(int wdl)
+{
+	return wdl == syzygy::WIN ? 1
+		: wdl == syzygy::CURSED_WIN ? 101
+		: wdl == syzygy::BLESSED_LOSS ? -101
+		: wdl == syzygy::LOSS ? -1 : 0;
+}
+
+int sign(int x) { return (x > 0) - (x < 0); }
+
+int probe_dtz(board::Board& B, int *state)
+{
+	*state = OK;
+	const int wdl = search(B, state, true);
+
+	// DTZ tables do not store draws
+	if (*state == FAIL || wdl == syzygy::DRAW)
+		return 0;
+
+	// the stored value is "don't care" when the best move zeroes the 50 move counter
+	if (*state == ZEROING_BEST_MOVE)
+		return dtz_before_zeroing(wdl);
+
+	int dtz = probe_table(B, DTZ_TABLE, wdl, state);
+	if (*state == FAIL)
+		return 0;
+
+	if (*state != CHANGE_STM)
+		return (dtz + 100 * (wdl == syzygy::BLESSED_LOSS || wdl == syzygy::CURSED_WIN)) * sign(wdl);
+
+	// The table stores the other side to move: do a 1 ply search, and find the move that
+	// minimizes DTZ
+	int min_dtz = INT_MAX;
+	move::move_t mlist[MAX_MOVES];
+	move::move_t *end = movegen::gen_moves(B, mlist);
+
+	for (move::move_t *m = mlist; m != end; ++m) {
+		const bool zeroing = is_capture(B, *m) || B.get_piece_on(m->fsq()) == PAWN;
+		B.play(*m);
+
+		// for zeroing moves, we want the DTZ before the move (the sign comes from the search)
+		dtz = zeroing ? -dtz_before_zeroing(search(B, state, false)) : -probe_dtz(B, state);
+
+		// mating move
+		if (dtz == 1 && is_mate(B))
+			min_dtz = 1;
+
+		if (!zeroing)
+			dtz += sign(dtz);
+
+		// only pick moves that preserve the WDL result
+		if (dtz < min_dtz && sign(dtz) == sign(wdl))
+			min_dtz = dtz;
+
+		B.undo();
+		if (*state == FAIL)
+			return 0;
+	}
+
+	// no legal moves: mated
+	return min_dtz == INT_MAX ? -1 : min_dtz;
+}
+
+void init_encoding()
+{
+	// MapB1H1H7[] maps the squares below the A1-H8 diagonal to 0..27
+	int code = 0;
+	for (int sq = A1; sq <= H8; ++sq)
+		if (off_a1h8(sq) < 0)
+			MapB1H1H7[sq] = code++;
+
+	// MapA1D1D4[] maps the A1-D1-D4 triangle to 0..9, diagonal squares last
+	std::vector<int> diagonal;
+	code = 0;
+	for (int sq = A1; sq <= D4; ++sq)
+		if (off_a1h8(sq) < 0 && file(sq) <= FILE_D)
+			MapA1D1D4[sq] = code++;
+		else if (!off_a1h8(sq) && file(sq) <= FILE_D)
+			diagonal.push_back(sq);
+	for (int sq : diagonal)
+		MapA1D1D4[sq] = code++;
+
+	// MapKK[] maps the 462 legal positions of 2 kings, the first one in the A1-D1-D4 triangle (and
+	// when it's on the diagonal, the second one not above it). Both on the diagonal come last.
+	std::vector<std::pair<int, int>> both_on_diagonal;
+	code = 0;
+	for (int idx = 0; idx < 10; ++idx)
+		for (int s1 = A1; s1 <= D4; ++s1)
+			if (MapA1D1D4[s1] == idx && (idx || s1 == B1)) {
+				for (int s2 = A1; s2 <= H8; ++s2)
+					if (bb::test_bit(bb::kattacks(s1) | (1ULL << s1), s2))
+						continue;
+					else if (!off_a1h8(s1) && off_a1h8(s2) > 0)
+						continue;
+					else if (!off_a1h8(s1) && !off_a1h8(s2))
+						both_on_diagonal.push_back(std::make_pair(idx, s2));
+					else
+						MapKK[idx][s2] = code++;
+			}
+	for (auto& p : both_on_diagonal)
+		MapKK[p.first][p.second] = code++;
+
+	// Binomial[k][n]: number of ways to choose k among n
+	Binomial[0][0] = 1;
+	for (int n = 1; n < 64; ++n)
+		for (int k = 0; k < 6 && k <= n; ++k)
+			Binomial[k][n] = (k > 0 ? Binomial[k - 1][n - 1] : 0) + (k < n ? Binomial[k][n - 1] : 0);
+
+	// MapPawns[] maps A2..H7 to 0..47: the leading pawn has the largest value, and the other pawns
+	// can only be on lower values. LeadPawnIdx[] and LeadPawnsSize[] encode the leading pawns.
+	int available_squares = 47;
+	for (int lead_pawns_cnt = 1; lead_pawns_cnt <= 5; ++lead_pawns_cnt)
+		for (int f = FILE_A; f <= FILE_D; ++f) {
+			int idx = 0;
+			for (int r = RANK_2; r <= RANK_7; ++r) {
+				const int sq = square(r, f);
+				if (lead_pawns_cnt == 1) {
+					MapPawns[sq] = available_squares--;
+					MapPawns[file_mirror(sq)] = available_squares--;
+				}
+				LeadPawnIdx[lead_pawns_cnt][sq] = idx;
+				idx += Binomial[lead_pawns_cnt - 1][MapPawns[sq]];
+			}
+			LeadPawnsSize[lead_pawns_cnt][f] = idx;
+		}
+}
+
+void add_table(const std::string& code, const std::vector<std::string>& dirs)
+{
+	std::unique_ptr<Table> t(new Table(code));
+
+	for (auto& dir : dirs)
+		if (t->load(WDL_TABLE, dir)) {
+			// DTZ tables are optional (only used at the root), and usually in the same directory
+			for (auto& dir2 : dirs)
+				if (t->load(DTZ_TABLE, dir2))
+					break;
+
+			syzygy::MaxPieces = std::max(syzygy::MaxPieces, t->piece_count);
+			TableByKey[t->key] = TableByKey[t->key2] = t.get();
+			Tables.push_back(std::move(t));
+			return;
+		}
+}
+
+void add_tables(std::string side1, int max_pieces, int last, const std::vector<std::string>& dirs)
+/* Tries to load all the tables "side1 v side2", for all possible sides, with up to max_pieces
+ * pieces. Pieces are in decreasing order on each side (KQRBNP), last is the smallest piece so far. */
+{
+	// side2
+	std::vector<std::string> stack(1, "K");
+	while (!stack.empty()) {
+		const std::string side2 = stack.back();
+		stack.pop_back();
+
+		if (side1.size() > 1 || side2.size() > 1)
+			add_table(side1 + 'v' + side2, dirs);
+
+		if (side1.size() + side2.size() < (size_t)max_pieces) {
+			const int last2 = side2.size() > 1 ? (int)board::PieceLabel[WHITE].find(side2.back()) : QUEEN;
+			for (int p = PAWN; p <= last2; ++p)
+				stack.push_back(side2 + board::PieceLabel[WHITE][p]);
+		}
+	}
+
+	// side1, longer
+	if (side1.size() + 1 < (size_t)max_pieces)
+		for (int p = PAWN; p <= last; ++p)
+			add_tables(side1 + board::PieceLabel[WHITE][p], max_pieces, p, dirs);
+}
+
+}	// namespace
+
+namespace syzygy {
+
+int MaxPieces = 0;
+
+int init(const std::string& path)
+{
+	static bool encoding_initialized = false;
+	if (!encoding_initialized) {
+		init_encoding();
+		encoding_initialized = true;
+	}
+
+	TableByKey.clear();
+	Tables.clear();
+	MaxPieces = 0;
+
+	if (path.empty() || path == "<empty>")
+		return 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+	const char separator = ';';
+#else
+	const char separator = ':';
+#endif
+
+	std::vector<std::string> dirs;
+	size_t first = 0, last;
+	do {
+		last = path.find(separator, first);
+		std::string dir = path.substr(first, last - first);
+		if (!dir.empty()) {
+			if (dir.back() != '/' && dir.back() != '\\')
+				dir += '/';
+			dirs.push_back(dir);
+		}
+		first = last + 1;
+	} while (last != std::string::npos);
+
+	add_tables("K", TBPIECES, QUEEN, dirs);
+
+	return Tables.size();
+}
+
+bool probe_wdl(board::Board& B, int *wdl)
+{
+	if (B.st().crights || bb::count_bit(B.st().occ) > MaxPieces)
+		return false;
+
+	int state = OK;
+	*wdl = search(B, &state, false);
+	return state != FAIL;
+}
+
+bool probe_dtz(board::Board& B, int *dtz)
+{
+	if (B.st().crights || bb::count_bit(B.st().occ) > MaxPieces)
+		return false;
+
+	int state;
+	*dtz = ::probe_dtz(B, &state);
+	return state != FAIL;
+}
+
+bool root_moves(board::Board& B, std::vector<move::move_t>& moves)
+{
+	if (B.st().crights || bb::count_bit(B.st().occ) > MaxPieces)
+		return false;
+
+	const int rule50 = B.st().rule50;
+	move::move_t mlist[MAX_MOVES];
+	move::move_t *end = movegen::gen_moves(B, mlist);
+	int ranks[MAX_MOVES], best_rank = -INT_MAX;
+
+	for (move::move_t *m = mlist; m != end; ++m) {
+		int state = OK, dtz;
+		B.play(*m);
+
+		// DTZ counted from the root position
+		if (!B.st().rule50)
+			// zeroing move
+			dtz = dtz_before_zeroing(-search(B, &state, false));
+		else if (B.is_draw())
+			dtz = 0;
+		else {
+			dtz = -::probe_dtz(B, &state);
+			dtz += sign(dtz);
+		}
+
+		// mating move
+		if (dtz == 2 && is_mate(B))
+			dtz = 1;
+
+		B.undo();
+		if (state == FAIL)
+			return false;
+
+		// Wins that can be converted before the 50 move rule all rank the same: the search chooses
+		// among them, and progress is guaranteed anyway, since the next root position is filtered
+		// again. Then come cursed wins, draws, blessed losses, and losses by DTZ (longest
+		// resistance first).
+		int& r = ranks[m - mlist];
+		r = dtz > 0 ? (dtz + rule50 <= 100 ? MAX_DTZ : 1)
+			: dtz < 0 ? (-dtz + rule50 <= 100 ? -MAX_DTZ - dtz : -1)
+			: 0;
+		best_rank = std::max(best_rank, r);
+	}
+
+	moves.clear();
+	for (move::move_t *m = mlist; m != end; ++m)
+		if (ranks[m - mlist] == best_rank)
+			moves.push_back(*m);
+
+	return !moves.empty();
+}
+
+bool check_encoding(const std::string& code)
+{
+	init_encoding();
+	Table t(code);
+
+	// Pieces in table order: as in code, but the leading pawns first. Real tables choose their own
+	// order (for compression), but the encoding must work with any of them.
+	std::vector<std::pair<int, int>> pieces;	// (color, piece)
+	int color = WHITE, pawns[NB_COLOR] = {};
+	for (char c : code)
+		if (c == 'v')
+			color = BLACK;
+		else {
+			pieces.push_back(std::make_pair(color, (int)board::PieceLabel[WHITE].find(c)));
+			pawns[color] += pieces.back().second == PAWN;
+		}
+
+	const int lead = pawns[WHITE] == t.pawn_count[0] ? WHITE : BLACK;
+	std::stable_partition(pieces.begin(), pieces.end(), [&](const std::pair<int, int>& p) {
+		return p.second == PAWN && p.first == lead;
+	});
+
+	const int n = pieces.size();
+	const bool pp = t.has_pawns && t.pawn_count[1];
+	const int order[2] = { 0, pp ? 1 : 0xF };
+	for (int f = FILE_A; f <= FILE_D; ++f)
+		for (int i = 0; i < 2; ++i) {
+			PairsData& d = t.items[WDL_TABLE][i][f];
+			for (int k = 0; k < n; ++k)
+				d.pieces[k] = tb_piece(pieces[k].first, pieces[k].second);
+			set_groups(t, &d, order, f);
+		}
+
+	// Symmetries: 1 = file mirror, 2 = rank mirror, 4 = A1-H8 diagonal flip (pawnless tables only)
+	auto transform = [](int sq, int s) {
+		if (s & 4)
+			sq = ((sq >> 3) | (sq << 3)) & 63;
+		return sq ^ (s & 1 ? 7 : 0) ^ (s & 2 ? 56 : 0);
+	};
+	const int symmetries = t.has_pawns ? 2 : 8;
+
+	// swap_colors gives the same position, with Black as the stronger side
+	auto fen = [&](const int *sq, int stm, bool swap_colors) {
+		char board[NB_SQUARE] = {};
+		for (int i = 0; i < n; ++i)
+			board[sq[i] ^ (swap_colors ? 56 : 0)] =
+				board::PieceLabel[pieces[i].first ^ swap_colors][pieces[i].second];
+
+		std::string s;
+		for (int r = RANK_8; r >= RANK_1; --r) {
+			int empty = 0;
+			for (int f = FILE_A; f <= FILE_H; ++f)
+				if (!board[square(r, f)])
+					++empty;
+				else {
+					if (empty)
+						s += char('0' + empty);
+					s += board[square(r, f)];
+					empty = 0;
+				}
+			if (empty)
+				s += char('0' + empty);
+			s += r > RANK_1 ? '/' : ' ';
+		}
+		return s + ((stm ^ swap_colors) ? "b" : "w") + " - - 0 1";
+	};
+
+	board::Board B;
+	auto index = [&](const std::string& pos, const PairsData **d) {
+		B.set_fen(pos);
+		uint64_t idx;
+		encode(B, t, WDL_TABLE, d, &idx);
+		return idx;
+	};
+
+	auto fail = [](const std::string& pos, const char *msg) {
+		std::cout << pos << '\t' << msg << std::endl;
+		return false;
+	};
+
+	// Canonical form (the smallest over all symmetries) of the position that uses each index
+	std::map<const PairsData *, std::vector<uint64_t>> owner;
+
+	int wk = 0, bk = 0;
+	for (int i = 0; i < n; ++i)
+		if (pieces[i].second == KING)
+			(pieces[i].first == WHITE ? wk : bk) = i;
+
+	// a sample of the positions (set_fen() is the bottleneck): the stride is odd, so that all the
+	// squares of each piece are visited
+	const uint64_t stride = n > 3 ? 997 : 5;
+	for (uint64_t c = 0; c < 1ULL << (6 * n); c += stride) {
+		int sq[TBPIECES];
+		Bitboard occ = 0;
+		bool valid = true;
+		for (int i = 0; i < n; ++i) {
+			sq[i] = (c >> (6 * i)) & 63;
+			valid &= !bb::test_bit(occ, sq[i]) && (pieces[i].second != PAWN
+				|| (rank(sq[i]) != RANK_1 && rank(sq[i]) != RANK_8));
+			bb::set_bit(&occ, sq[i]);
+		}
+		if (!valid || bb::kdist(sq[wk], sq[bk]) <= 1)
+			continue;
+
+		bool check[NB_COLOR];
+		for (int stm = WHITE; stm <= BLACK; ++stm) {
+			B.set_fen(fen(sq, stm, false));
+			check[stm] = B.is_check();
+		}
+
+		for (int stm = WHITE; stm <= BLACK; ++stm) {
+			// the side that just moved cannot be in check
+			if (check[opp_color(stm)])
+				continue;
+
+			const std::string f = fen(sq, stm, false);
+			const PairsData *d, *d2;
+			const uint64_t idx = index(f, &d);
+
+			int k = 0;
+			while (d->group_len[k])
+				++k;
+			if (idx >= d->group_idx[k])
+				return fail(f, "index out of range");
+
+			// Symmetric positions have the same index, except when the leading group is on the
+			// diagonal: the other pieces are then not flipped, so both positions are stored.
+			bool diagonal[2] = { true, true };
+			for (int i = 0; i < d->group_len[0]; ++i) {
+				diagonal[0] &= rank(sq[i]) == file(sq[i]);
+				diagonal[1] &= rank(sq[i]) + file(sq[i]) == 7;
+			}
+			const bool keep_diagonal = n > d->group_len[0] && (diagonal[0] || diagonal[1]);
+
+			uint64_t canonical = UINT64_MAX;
+			for (int s = 0; s < symmetries; ++s) {
+				int sq2[TBPIECES], sorted[TBPIECES];
+				for (int i = 0; i < n; ++i)
+					sorted[i] = sq2[i] = transform(sq[i], s);
+
+				// identical pieces can be swapped
+				for (int i = 0, j; i < n; i = j) {
+					j = i + 1;
+					while (j < n && pieces[j] == pieces[i])
+						++j;
+					std::sort(sorted + i, sorted + j);
+				}
+
+				uint64_t packed = stm;
+				for (int i = 0; i < n; ++i)
+					packed = packed << 6 | sorted[i];
+				canonical = std::min(canonical, packed);
+
+				if (s && !(keep_diagonal && (s & 4)) && index(fen(sq2, stm, false), &d2) != idx)
+					return fail(f, "symmetric position with another index");
+			}
+
+			if (index(fen(sq, stm, true), &d2) != idx || d2 != d)
+				return fail(f, "colors swapped with another index");
+
+			// different positions have different indexes
+			std::vector<uint64_t>& o = owner[d];
+			if (o.empty())
+				o.resize(d->group_idx[k], UINT64_MAX);
+			if (o[idx] != UINT64_MAX && o[idx] != canonical)
+				return fail(f, "index collision");
+			o[idx] = canonical;
+		}
+	}
+
+	return true;
+}
+
+}	// namespace syzygy
@@ -0,0 +1,46 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include "board.h"
+
+namespace syzygy {
+
+// WDL scores, from the side to move's point of view. A cursed win is a win that the 50 move rule
+// turns into a draw, a blessed loss is the corresponding loss.
+enum { LOSS = -2, BLESSED_LOSS = -1, DRAW = 0, CURSED_WIN = 1, WIN = 2 };
+
+extern int MaxPieces;	// largest number of pieces in the tables found (0 when there are none)
+
+// Maps all the tables found in path (directories separated by ':', or ';' on Windows). Returns the
+// number of tables found. Not thread safe: do not call it during a search.
+extern int init(const std::string& path);
+
+// These return false when the probe fails (missing table, castling rights). B is modified during
+// the probe, but restored before returning.
+extern bool probe_wdl(board::Board& B, int *wdl);
+extern bool probe_dtz(board::Board& B, int *dtz);
+
+// Fills moves with the root moves that preserve the best DTZ outcome: all the wins that can be
+// converted before the 50 move rule, or the longest resistance when losing.
+extern bool root_moves(board::Board& B, std::vector<move::move_t>& moves);
+
+// Self check of the index encoding of the table code (eg. "KRvKN"), which needs no table file (see
+// test.cc): indexes are within the table size, symmetric positions have the same index, and
+// different positions have different indexes. Not thread safe.
+extern bool check_encoding(const std::string& code);
+
+}	// namespace syzygy
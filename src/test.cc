@@ -1,79 +1,256 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include "search.h"
+#include "eval.h"
+#include "bitbase.h"
+#include "movesort.h"
+#include "prng.h"
+#include "syzygy.h"
+#include "test.h"
 
 using namespace std::chrono;
 
-uint64_t perft(board::Board& B, int depth, int ply)
-/* Calculates perft(depth), and displays all perft(depth-1) in the initial position. This
- * decomposition is useful to debug an incorrect perft recursively, against a correct perft
- * generator */
+namespace {
+
+const char *BenchFens[] = {
+	"r1bqkbnr/pp1ppppp/2n5/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq -",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
+	"4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+	"rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+	"r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+	"1rbqk1nr/p3ppbp/2np2p1/2p5/1p2PP2/3PB1P1/PPPQ2BP/R2NK1NR b KQk -",
+	"r1bqk2r/pp1p1ppp/2n1pn2/2p5/1bPP4/2NBP3/PP2NPPP/R1BQK2R b KQkq -",
+	"rnb1kb1r/ppp2ppp/1q2p3/4P3/2P1Q3/5N2/PP1P1PPP/R1B1KB1R b KQkq -",
+	"r1b2rk1/pp2nppp/1b2p3/3p4/3N1P2/2P2NP1/PP3PBP/R3R1K1 b - -",
+	"n1q1r1k1/3b3n/p2p1bp1/P1pPp2p/2P1P3/2NBB2P/3Q1PK1/1R4N1 b - -",
+	"r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+	"3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+	"r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+	"4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+	"3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+	"2r5/8/1n6/1P1p1pkp/p2P4/R1P1PKP1/8/1R6 w - - 0 1",
+	"r2q1rk1/1b1nbppp/4p3/3pP3/p1pP4/PpP2N1P/1P3PP1/R1BQRNK1 b 0 1",
+	"6k1/5pp1/7p/p1p2n1P/P4N2/6P1/1P3P1K/8 w - - 0 35",
+	"r4rk1/1pp1q1pp/p2p4/3Pn3/1PP1Pp2/P7/3QB1PP/2R2RK1 b 0 1",
+	nullptr
+};
+
+void collect_nodes(board::Board& B, int depth, std::vector<std::string>& fens, History& H, PRNG& prng)
+/* Collects the FEN of all the nodes of the tree, and fills H with some random history scores */
 {
 	move::move_t mlist[MAX_MOVES];
-	move::move_t *begin = mlist, *m;
 	move::move_t *end = movegen::gen_moves(B, mlist);
-	uint64_t count;
 
-	if (depth > 1) {
-		for (m = begin, count = 0ULL; m < end; m++) {
-			uint64_t count_subtree;
+	fens.push_back(B.get_fen());
+
+	for (move::move_t *m = mlist; m != end; ++m) {
+		if (!move::is_cop(B, *m))
+			H.add(B, *m, int(prng.rand() % 201) - 100);
 
+		if (depth > 1) {
 			B.play(*m);
-			count += count_subtree = perft(B, depth - 1, ply + 1);
+			collect_nodes(B, depth - 1, fens, H, prng);
 			B.undo();
-
-			if (!ply)
-				std::cout << move_to_string(*m) << '\t' << count_subtree << std::endl;
 		}
-	} else {
-		count = end - begin;
-		if (!ply)
-			for (m = begin; m < end; m++)
-				std::cout << move_to_string(*m) << std::endl;
 	}
+}
 
-	return count;
+struct PerftTest {
+	std::string fen;
+	int depth;
+	uint64_t value;
+};
+
+/* Perft hash table: counts of the subtrees, by key and depth. Lockless, like the TT (see tt.h): the
+ * key is stored XOR-ed with the data, so an entry torn by concurrent writes is a miss. */
+class PerftTable {
+public:
+	explicit PerftTable(int mb) {
+		size_t n = mb > 0 ? ((size_t)mb << 20) / sizeof(Entry) : 0;
+		while (n & (n - 1))
+			n &= n - 1;	// round down to a power of 2
+		entry.resize(n);
+	}
+
+	bool probe(Key key, int depth, uint64_t *count) const {
+		if (entry.empty())
+			return false;
+		const Entry& e = entry[key & (entry.size() - 1)];
+		if ((e.key ^ e.data) != key || int(e.data & 0xff) != depth)
+			return false;
+		*count = e.data >> 8;
+		return true;
+	}
+
+	void store(Key key, int depth, uint64_t count) {
+		if (entry.empty())
+			return;
+		Entry& e = entry[key & (entry.size() - 1)];
+		e.data = count << 8 | depth;
+		e.key = key ^ e.data;
+	}
+
+private:
+	struct Entry {
+		Key key;
+		uint64_t data;	// bits 0..7 for depth, and 8..63 for count
+	};
+	std::vector<Entry> entry;
+};
+
+move::move_t *gen_legal(const board::Board& B, move::move_t *mlist, bool pseudo)
+/* Legal moves: from the legal generator, or from the pseudo-legal one, filtered by move::is_legal()
+ * (as the search does) */
+{
+	move::move_t *end = pseudo ? movegen::gen_pseudo_moves(B, mlist) : movegen::gen_moves(B, mlist);
+	if (pseudo && !B.is_check())
+		end = std::remove_if(mlist, end, [&B](move::move_t m) { return !move::is_legal(B, m); });
+	return end;
 }
 
-bool test_perft()
+uint64_t perft_node(board::Board& B, int depth, bool pseudo, PerftTable& T)
+/* Bulk counting: the moves at depth 1 are counted, not played */
 {
-	board::Board B;
+	assert(depth >= 1);
+	uint64_t count;
+	if (depth > 1 && T.probe(B.get_key(), depth, &count))
+		return count;
 
-	struct TestPerft {
-		const char *s;
-		int depth;
-		uint64_t value;
-	};
+	move::move_t mlist[MAX_MOVES];
+	move::move_t *end = gen_legal(B, mlist, pseudo);
 
-	// http://chessprogramming.wikispaces.com/Perft+Results
-	TestPerft Test[] = {
-		{"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 6, 119060324ull},
-		{"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -", 5, 193690690ull},
-		{"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -", 7, 178633661ull},
-		{"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 6, 706045033ull},
-		{"rnbqkb1r/pp1p1ppp/2p5/4P3/2B5/8/PPP1NnPP/RNBQK2R w KQkq - 0 6", 5, 70202861ull},
-		{nullptr, 0, 0}
-	};
+	if (depth == 1)
+		return end - mlist;
+
+	count = 0;
+	for (move::move_t *m = mlist; m != end; ++m) {
+		B.play(*m);
+		count += perft_node(B, depth - 1, pseudo, T);
+		B.undo();
+	}
+
+	T.store(B.get_key(), depth, count);
+	return count;
+}
 
+bool run_perft(const std::vector<PerftTest>& Tests, int threads, int hash, bool pseudo)
+{
 	uint64_t total = 0;
 	auto start = high_resolution_clock::now();
 
-	for (int i = 0; Test[i].s; i++) {
-		std::cout << Test[i].s << std::endl;
-		B.set_fen(Test[i].s);
-		if (perft(B, Test[i].depth, 0) != Test[i].value) {
-			std::cerr << "Incorrect perft" << std::endl;
+	for (const PerftTest& t : Tests) {
+		board::Board B;
+		B.set_fen(t.fen);
+		std::cout << t.fen << "\tdepth " << t.depth << std::endl;
+		if (perft(B, t.depth, threads, hash, pseudo) != t.value) {
+			std::cerr << "Incorrect perft" << (pseudo ? " (pseudo-legal)" : "") << std::endl;
 			return false;
 		}
-		total += Test[i].value;
+		total += t.value;
 	}
 
 	auto stop = high_resolution_clock::now();
 	int elapsed = duration_cast<microseconds>(stop - start).count();
-	std::cout << "speed: " << (int)(total / (double)elapsed * 1e6) << " leaf/sec" << std::endl;
+	std::cout << "speed" << (pseudo ? " (pseudo-legal)" : "") << ": "
+		<< (int)(total / (double)elapsed * 1e6) << " leaf/sec" << std::endl;
 
 	return true;
 }
 
+}	// namespace
+
+uint64_t perft(const board::Board& B, int depth, int threads, int hash, bool pseudo, bool divide)
+/* Calculates perft(depth). The root moves are shared among threads, and the perft hash table (if
+ * hash > 0) among all of them. If divide, displays all perft(depth-1) of the root moves. This
+ * decomposition is useful to debug an incorrect perft recursively, against a correct perft
+ * generator. */
+{
+	if (depth <= 0)
+		return 1;
+
+	move::move_t mlist[MAX_MOVES];
+	const int cnt = gen_legal(B, mlist, pseudo) - mlist;
+	std::vector<uint64_t> counts(cnt, 1);
+
+	if (depth > 1) {
+		PerftTable T(hash);
+		std::atomic<int> next(0);
+		std::vector<std::thread> workers;
+
+		for (int i = 0; i < std::max(1, std::min(threads, cnt)); ++i)
+			workers.push_back(std::thread([&]() {
+				board::Board pos(B);
+				for (int j; (j = next++) < cnt; ) {
+					pos.play(mlist[j]);
+					counts[j] = perft_node(pos, depth - 1, pseudo, T);
+					pos.undo();
+				}
+			}));
+
+		for (auto& t : workers)
+			t.join();
+	}
+
+	if (divide)
+		for (int j = 0; j < cnt; ++j)
+			std::cout << move_to_string(mlist[j]) << '\t' << counts[j] << std::endl;
+
+	return std::accumulate(counts.begin(), counts.end(), 0ULL);
+}
+
+bool test_perft(int threads, int hash)
+/* Checks both generators, legal and pseudo-legal, against the known perft values */
+{
+	// http://chessprogramming.wikispaces.com/Perft+Results
+	const std::vector<PerftTest> Tests = {
+		{"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 6, 119060324ull},
+		{"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -", 5, 193690690ull},
+		{"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -", 7, 178633661ull},
+		{"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 6, 706045033ull},
+		{"rnbqkb1r/pp1p1ppp/2p5/4P3/2B5/8/PPP1NnPP/RNBQK2R w KQkq - 0 6", 5, 70202861ull}
+	};
+
+	return run_perft(Tests, threads, hash, false) && run_perft(Tests, threads, hash, true);
+}
+
+bool test_perft_epd(const std::string& file, int threads, int hash)
+/* Runs the perft tests of an EPD file, where each line is a FEN followed by the expected counts:
+ * "<fen> ;D1 <count> ;D2 <count> ..." */
+{
+	std::ifstream f(file);
+	if (!f) {
+		std::cerr << "cannot open " << file << std::endl;
+		return false;
+	}
+
+	std::vector<PerftTest> Tests;
+	std::string line, field;
+
+	while (getline(f, line)) {
+		std::istringstream is(line);
+		if (!getline(is, field, ';') || field.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		const std::string fen = field;
+		while (getline(is, field, ';')) {
+			std::istringstream fs(field);
+			char d;
+			PerftTest t = {fen, 0, 0};
+			if (fs >> d >> t.depth >> t.value && d == 'D')
+				Tests.push_back(t);
+		}
+	}
+
+	return run_perft(Tests, threads, hash, false);
+}
+
 bool test_see()
 {
 	struct TestSEE {
@@ -114,45 +291,96 @@ bool test_see()
 	return true;
 }
 
-void bench(int depth)
+bool test_syzygy(const std::string& path)
+/* Checks the index encoding of a few tables (which needs no table file), and if path is given, the
+ * probes against known values. The tables must be there (KQvK, KRvK, KPvK and KRvKN): a missing
+ * one is a failure, not a skipped test. */
 {
-	static const char *test[] = {
-		"r1bqkbnr/pp1ppppp/2n5/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq -",
-		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
-		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
-		"4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
-		"rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
-		"r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
-		"1rbqk1nr/p3ppbp/2np2p1/2p5/1p2PP2/3PB1P1/PPPQ2BP/R2NK1NR b KQk -",
-		"r1bqk2r/pp1p1ppp/2n1pn2/2p5/1bPP4/2NBP3/PP2NPPP/R1BQK2R b KQkq -",
-		"rnb1kb1r/ppp2ppp/1q2p3/4P3/2P1Q3/5N2/PP1P1PPP/R1B1KB1R b KQkq -",
-		"r1b2rk1/pp2nppp/1b2p3/3p4/3N1P2/2P2NP1/PP3PBP/R3R1K1 b - -",
-		"n1q1r1k1/3b3n/p2p1bp1/P1pPp2p/2P1P3/2NBB2P/3Q1PK1/1R4N1 b - -",
-		"r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
-		"3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
-		"r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
-		"4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
-		"3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
-		"2r5/8/1n6/1P1p1pkp/p2P4/R1P1PKP1/8/1R6 w - - 0 1",
-		"r2q1rk1/1b1nbppp/4p3/3pP3/p1pP4/PpP2N1P/1P3PP1/R1BQRNK1 b 0 1",
-		"6k1/5pp1/7p/p1p2n1P/P4N2/6P1/1P3P1K/8 w - - 0 35",
-		"r4rk1/1pp1q1pp/p2p4/3Pn3/1PP1Pp2/P7/3QB1PP/2R2RK1 b 0 1",
-		nullptr
+	for (auto code : {"KQvK", "KRvK", "KPvK", "KRvKN"}) {
+		std::cout << "encoding " << code << std::endl;
+		if (!syzygy::check_encoding(code))
+			return false;
+	}
+
+	if (path.empty())
+		return true;
+	std::cout << syzygy::init(path) << " tables found" << std::endl;
+
+	struct TestTB {
+		const char *fen;
+		int wdl, dtz;			// dtz = 0: not checked (long wins, and draws)
+		const char *move, *bad;	// a root move (preserving the outcome), and a move that spoils it
+	};
+
+	TestTB test[] = {
+		{"k7/8/1K6/8/8/8/8/2Q5 w - -", syzygy::WIN, 1, "c1c8", "c1c7"},		// mate, stalemate
+		{"k7/8/1K6/8/8/8/8/2Q5 b - -", syzygy::LOSS, -4, "a8b8", NULL},
+		{"8/8/8/8/8/8/k7/1R5K w - -", syzygy::WIN, 0, "b1b8", "b1b2"},
+		{"8/8/8/8/8/8/k7/1R5K b - -", syzygy::DRAW, 0, "a2b1", NULL},
+		{"4k3/8/4K3/8/4P3/8/8/8 w - -", syzygy::WIN, 1, "e4e5", NULL},
+		{"4k3/8/4K3/4P3/8/8/8/8 b - -", syzygy::LOSS, -4, "e8d8", NULL},
+		{"k7/8/8/8/8/8/P7/1K6 w - -", syzygy::DRAW, 0, "a2a4", NULL},
+		{"k7/8/8/8/8/8/1n6/KR6 w - -", syzygy::WIN, 1, "b1b2", NULL},
+		{"k6K/8/8/8/8/3n4/8/4R3 b - -", syzygy::DRAW, 0, "d3e1", NULL},
+		{NULL, 0, 0, NULL, NULL}
 	};
 
+	board::Board B;
+
+	for (int i = 0; test[i].fen; ++i) {
+		B.set_fen(test[i].fen);
+		std::cout << test[i].fen << std::endl;
+
+		int wdl, dtz;
+		std::vector<move::move_t> moves;
+		if (!syzygy::probe_wdl(B, &wdl) || !syzygy::probe_dtz(B, &dtz)
+				|| !syzygy::root_moves(B, moves)) {
+			std::cout << "missing table in " << path << std::endl;
+			return false;
+		}
+
+		// DTZ may be rounded: n can mean n or n+1 plies
+		const bool dtz_ok = !test[i].dtz || dtz == test[i].dtz
+			|| dtz == test[i].dtz + (test[i].dtz > 0 ? 1 : -1);
+		auto found = [&](const char *s) {
+			return std::find(moves.begin(), moves.end(), move::string_to_move(B, s)) != moves.end();
+		};
+
+		if (wdl != test[i].wdl || !dtz_ok || !found(test[i].move)
+				|| (test[i].bad && found(test[i].bad))) {
+			std::cout << B << "WDL = " << wdl << ", DTZ = " << dtz << ", root moves:";
+			for (auto m : moves)
+				std::cout << ' ' << move_to_string(m);
+			std::cout << "\nshould be WDL = " << test[i].wdl << ", DTZ = " << test[i].dtz
+				<< ", with " << test[i].move << (test[i].bad ? " without " : "")
+				<< (test[i].bad ? test[i].bad : "") << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void bench(int depth, int hash)
+/* hash in MB: large values are useful to measure the effect of TLB misses on TT probing */
+{
+
 	board::Board B;
 	search::Limits sl;
 	sl.depth = depth;
 	uint64_t nodes = 0;
 
-	search::TT.alloc(32ULL << 20);
+	search::TT.alloc((uint64_t)hash << 20);
 	search::clear_state();
+	bitbase::wait();	// node counts must not depend on when the bitbases are ready
+	eval::PawnStats.clear();
+	eval::EvalStats.clear();
 
 	time_point<high_resolution_clock> start, end;
 	start = high_resolution_clock::now();
 
-	for (int i = 0; test[i]; ++i) {
-		B.set_fen(test[i]);
+	for (int i = 0; BenchFens[i]; ++i) {
+		B.set_fen(BenchFens[i]);
 
 		std::cout << B.get_fen() << std::endl;
 		bestmove(B, sl);
@@ -166,5 +394,61 @@ void bench(int depth)
 
 	std::cout << "nodes = " << nodes << std::endl;
 	std::cout << "kn/s = " << nodes / (double)elapsed_usec * 1e3 << std::endl;
+	std::cout << "pawn cache hits = " << eval::PawnStats.hit_rate() << "%" << std::endl;
+	std::cout << "eval cache hits = " << eval::EvalStats.hit_rate() << "%" << std::endl;
 }
 
+
+void bench_movesort()
+/* Microbenchmark of the move ordering: cost of MoveSort (generation, scoring and selection) per node,
+ * on the bench positions and their children. Cut nodes stop at the first move, All nodes try them
+ * all. The remaining depth matters: quiet moves are only partially sorted at low depth. */
+{
+	static const int Repeat = 500;
+
+	board::Board B;
+	History H;
+	static Refutation R;	// too large for the stack
+	SearchInfo ss[2];
+	PRNG prng;
+	std::vector<std::string> fens;
+
+	H.clear();
+	R.clear();
+	ss[0].clear(0);
+	ss[1].clear(1);
+
+	for (int i = 0; BenchFens[i]; ++i) {
+		B.set_fen(BenchFens[i]);
+		collect_nodes(B, 2, fens, H, prng);
+	}
+	std::cout << "nodes = " << fens.size() << std::endl;
+
+	for (int depth = 2; depth <= 8; depth += 6) {
+		int64_t cut_ns = 0, all_ns = 0;
+		int see;
+
+		for (const std::string& fen : fens) {
+			B.set_fen(fen);
+
+			auto start = high_resolution_clock::now();
+			for (int r = 0; r < Repeat; ++r) {
+				MoveSort MS(&B, depth, &ss[1], &H, &R);
+				MS.next(&see);
+			}
+			auto middle = high_resolution_clock::now();
+			for (int r = 0; r < Repeat; ++r) {
+				MoveSort MS(&B, depth, &ss[1], &H, &R);
+				while (MS.next(&see));
+			}
+			auto end = high_resolution_clock::now();
+
+			cut_ns += duration_cast<nanoseconds>(middle - start).count();
+			all_ns += duration_cast<nanoseconds>(end - middle).count();
+		}
+
+		const double n = double(fens.size()) * Repeat;
+		std::cout << "depth " << depth << ": Cut node = " << cut_ns / n << " ns, All node = "
+			<< all_ns / n << " ns" << std::endl;
+	}
+}
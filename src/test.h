@@ -1,9 +1,15 @@
 #pragma once
 #include "board.h"
 
-extern uint64_t perft(board::Board& B, int depth, int ply);
-extern bool test_perft();
+/* Multi-threaded, bulk-counting perft, with a hash table of hash MB (0 = none). If pseudo, uses the
+ * pseudo-legal generator and move::is_legal(), as the search does. */
+extern uint64_t perft(const board::Board& B, int depth, int threads = 1, int hash = 0, bool pseudo = false,
+	bool divide = false);
+extern bool test_perft(int threads = 1, int hash = 0);
+extern bool test_perft_epd(const std::string& file, int threads = 1, int hash = 0);
 extern bool test_see();
+extern bool test_syzygy(const std::string& path);
 
-extern void bench(int depth);
+extern void bench(int depth, int hash);
+extern void bench_movesort();
 
@@ -16,16 +16,26 @@
  * - TT entry replacement scheme replicates what Stockfish does. Thanks to Tord Romstad and Marco
  * Costalba.
 */
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
 #include "tt.h"
 #include "move.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace {
 
 void *aligned_malloc(size_t size, size_t align)
 {
 	void *mem = malloc(size + (align - 1) + sizeof(void*));
-	if (!mem) throw std::bad_alloc();
+	if (!mem) std::abort();	// built without exceptions (see make.sh)
 
 	char *amem = ((char*)mem) + sizeof(void*);
 	amem += align - ((std::uintptr_t)amem & (align - 1));
@@ -39,41 +49,139 @@ void aligned_free(void *mem)
 	free(((void**)mem)[-1]);
 }
 
+#if defined(__linux__)
+
+const size_t HugePageSize = 2 << 20;
+
+void *huge_alloc(size_t size)
+/* Allocates size bytes (a multiple of HugePageSize), aligned on HugePageSize, and asks the kernel to
+ * back them with transparent huge pages. If THP are disabled, madvise() fails and we simply get normal
+ * pages. Returns nullptr if mmap() fails. */
+{
+	// mmap() only guarantees page alignment, so map one more huge page, and trim the excess
+	char *mem = (char *)mmap(nullptr, size + HugePageSize, PROT_READ | PROT_WRITE,
+							 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return nullptr;
+
+	char *amem = (char *)(((std::uintptr_t)mem + HugePageSize - 1) & ~(HugePageSize - 1));
+	if (amem > mem)
+		munmap(mem, amem - mem);
+	munmap(amem + size, mem + HugePageSize - amem);
+
+#ifdef MADV_HUGEPAGE
+	madvise(amem, size, MADV_HUGEPAGE);
+#endif
+
+	return amem;
+}
+
+void numa_interleave(void *mem, size_t size)
+/* Interleave the pages of [mem, mem+size[ across all online NUMA nodes. Must be called before the
+ * memory is first touched. Does nothing on a single node machine, or if mbind() is not supported. */
+{
+#ifdef SYS_mbind
+	// parse the list of online nodes, eg. "0-3,6"
+	std::ifstream f("/sys/devices/system/node/online");
+	unsigned long mask = 0;
+	int first, last;
+	char c;
+	while (f >> first) {
+		last = first;
+		if (f.peek() == '-')
+			f >> c >> last;
+		for (int node = first; node <= last && node < 64; ++node)
+			mask |= 1UL << node;
+		if (!(f >> c))
+			break;
+	}
+
+	if (bb::several_bits(mask)) {
+		const int MPOL_INTERLEAVE = 3;	// from <numaif.h>, which requires libnuma
+		syscall(SYS_mbind, mem, size, MPOL_INTERLEAVE, &mask, 64, 0);
+	}
+#else
+	(void)mem, (void)size;
+#endif
+}
+
+#endif
+
 }	// namespace
 
 TTable::~TTable()
 {
-	if (count)
+	free_clusters();
+	generation = 0;
+}
+
+void TTable::free_clusters()
+{
+	if (!count)
+		return;
+
+#if defined(__linux__)
+	if (mapped)
+		munmap(cluster, count * sizeof(Cluster));
+	else
+#endif
 		aligned_free(cluster);
 
 	cluster = nullptr;
-	generation = 0;
 	count = 0;
 }
 
-void TTable::alloc(uint64_t size)
+void TTable::alloc(uint64_t size, bool interleave, int threads)
 {
 	// calculate the number of clusters allocate (count must be a power of two)
 	size_t new_count = 1ULL << bb::msb(size / sizeof(Cluster));
 
 	// nothing to do if already allocated to the given size
-	if (new_count == count)
+	if (new_count == count && interleave == interleaved)
 		return;
 
-	if (cluster)
-		aligned_free(cluster);
+	free_clusters();
+	mapped = false;
 
-	// Allocate the cluster array. On failure, std::bad_alloc is thrown and not caught, which
-	// terminates the program. It's not a bug, it's a "feature".
-	cluster = (Cluster *)aligned_malloc(new_count * sizeof(Cluster), 64);
+#if defined(__linux__)
+	// large TT: use huge pages to save TLB misses in probe()
+	if (new_count * sizeof(Cluster) >= HugePageSize
+		&& (cluster = (Cluster *)huge_alloc(new_count * sizeof(Cluster)))) {
+		mapped = true;
+		if (interleave)
+			numa_interleave(cluster, new_count * sizeof(Cluster));
+	}
+#endif
+
+	// Allocate the cluster array. On failure, the program is terminated. It's not a bug, it's a
+	// "feature".
+	if (!mapped)
+		cluster = (Cluster *)aligned_malloc(new_count * sizeof(Cluster), 64);
 
 	count = new_count;
-	clear();
+	interleaved = interleave;
+	clear(threads);
 }
 
-void TTable::clear()
+void TTable::clear(int threads)
+/* Clearing a multi GB table takes seconds on a single thread, so it is split in one chunk per thread.
+ * This is also where the pages are first touched, so that they end up spread over the NUMA nodes of
+ * the threads that clear them. Each thread gets at least 16 MB. */
 {
-	std::memset(cluster, 0, count * sizeof(Cluster));
+	threads = std::max(1, std::min<int>(threads, (count * sizeof(Cluster)) >> 24));
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; ++i) {
+		const size_t first = count * i / threads, last = count * (i + 1) / threads;
+		Cluster *c = cluster;
+		workers.push_back(std::thread([c, first, last]() {
+			std::memset((void *)(c + first), 0, (last - first) * sizeof(Cluster));
+		}));
+	}
+
+	for (auto& t : workers)
+		t.join();
+
 	generation = 0;
 }
 
@@ -82,26 +190,52 @@ void TTable::new_search()
 	++generation;
 }
 
-const TTable::Entry *TTable::probe(Key key) const
+const TTable::Entry *TTable::probe(Key key, Entry *copy) const
+/* Returns a pointer to copy, filled with the entry matching key (if any), or nullptr otherwise */
 {
 	const Entry *e = &cluster[key & (count - 1)].entry[0];
 
-	for (size_t i = 0; i < 4; ++i, ++e)
-		if (e->key_match(key))
-			return e;
+	for (size_t i = 0; i < 4; ++i, ++e) {
+		*copy = *e;
+		copy->key_type ^= copy->data();
+		if (copy->key_match(key))
+			return copy;
+	}
 
 	return nullptr;
 }
 
+void TTable::refresh(Key key) const
+{
+	Entry *e = cluster[key & (count - 1)].entry;
+
+	for (size_t i = 0; i < 4; ++i, ++e)
+		if (e->key_match(key ^ e->data())) {
+			e->generation = generation;
+			return;
+		}
+}
+
+uint64_t TTable::Entry::data() const
+{
+	uint16_t m;
+	std::memcpy(&m, &move, sizeof(m));
+
+	return (uint64_t)(uint8_t)depth
+		^ (uint64_t)(uint16_t)score << 8
+		^ (uint64_t)(uint16_t)eval << 24
+		^ (uint64_t)m << 40;
+}
+
 void TTable::Entry::save(Key k, uint8_t g, int nt, int8_t d, int16_t s, int16_t e,
 						 move::move_t m)
 {
-	key_type = (k & ~3ULL) ^ (nt + 1);
 	generation = g;
 	depth = d;
 	score = s;
 	eval = e;
 	move = m;
+	key_type = ((k & ~3ULL) ^ (nt + 1)) ^ data();
 }
 
 void TTable::store(Key key, int node_type, int8_t depth, int16_t score, int16_t eval, move::move_t move)
@@ -109,17 +243,20 @@ void TTable::store(Key key, int node_type, int8_t depth, int16_t score, int16_t
 	Entry *e = cluster[key & (count - 1)].entry, *replace = e;
 
 	for (size_t i = 0; i < 4; ++i, ++e) {
+		Entry tmp = *e;
+		tmp.key_type ^= tmp.data();
+
 		// overwrite empty or old
-		if (!e->key_type || e->key_match(key)) {
+		if (!e->key_type || tmp.key_match(key)) {
 			replace = e;
 			if (!move)
-				move = e->move;
+				move = tmp.move;
 			break;
 		}
 
 		// Stockfish replacement strategy
 		int c1 = generation == replace->generation ? 2 : 0;
-		int c2 = e->generation == generation || e->node_type() == PV ? -2 : 0;
+		int c2 = tmp.generation == generation || tmp.node_type() == PV ? -2 : 0;
 		int c3 = e->depth < replace->depth ? 1 : 0;
 		if (c1 + c2 + c3 > 0)
 			replace = e;
@@ -17,6 +17,10 @@
 
 enum { PV = 0, All = -1, Cut = +1 };
 
+/* Lockless hashing: the TT is shared between search threads, without any locking. An entry is stored
+ * with its key_type XOR-ed with the rest of the entry (except the generation, which is refreshed in
+ * place). An entry that has been torn by concurrent writes no longer verifies its key, and is seen
+ * as a miss. Probing returns a verified copy of the entry, never a pointer into the table. */
 class TTable {
 public:
 	struct Entry {
@@ -36,24 +40,26 @@ public:
 
 		void save(Key k, uint8_t g, int nt, int8_t d, int16_t s, int16_t e,
 				  move::move_t m);
+		uint64_t data() const;	// everything but key_type and generation, packed in 64 bits
 	};
 
 	struct Cluster {
 		Entry entry[4];
 	};
 
-	TTable(): count(0), cluster(nullptr) {}
+	TTable(): count(0), cluster(nullptr), mapped(false), interleaved(false) {}
 	~TTable();
 
-	void alloc(uint64_t size);
-	void clear();
+	// interleave: spread the table across NUMA nodes (Linux only)
+	// threads: number of threads used to clear (and first touch) the table. Callers use all the
+	// cores, regardless of the Threads option: clearing is not a search.
+	void alloc(uint64_t size, bool interleave = false, int threads = 1);
+	void clear(int threads = 1);
 
 	void new_search();
-	void refresh(const Entry *e) const {
-		e->generation = generation;
-	}
+	void refresh(Key key) const;
 
-	const Entry *probe(Key key) const;
+	const Entry *probe(Key key, Entry *copy) const;
 	void prefetch(Key key) const {
 		__builtin_prefetch((char *)&cluster[key & (count - 1)]);
 	}
@@ -63,5 +69,9 @@ private:
 	size_t count;
 	uint8_t generation;
 	Cluster *cluster;
+	bool mapped;		// cluster allocated by mmap() (huge pages), rather than malloc()
+	bool interleaved;
+
+	void free_clusters();
 };
 
@@ -12,29 +12,30 @@
  * You should have received a copy of the GNU General Public License along with this program. If not,
  * see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <sstream>
+#include <thread>
 #include "uci.h"
 #include "search.h"
 #include "eval.h"
+#include "syzygy.h"
 #include "test.h"
 
-#if defined(_WIN32) || defined(_WIN64)
-#include <windows.h>
-#include <conio.h>
-#else   // assume POSIX
-#include <cerrno>
-#include <unistd.h>
-#include <sys/time.h>
-#endif
-
 namespace uci {
 
 int Hash = 16;
+int PawnHash = 2;
+int Threads = 1;
 int Contempt = 25;
 const int ELO_MIN = 1500, ELO_MAX = 2700;
-bool LimitStrength = false, Ponder = false, Analyze = false;
+bool LimitStrength = false, Ponder = false, Analyze = false, NumaInterleave = false;
 int Elo = ELO_MIN;
 int TimeBuffer = 100;
+std::string SyzygyPath = "<empty>";
+int SyzygyProbeDepth = 1;
+int SyzygyProbeLimit = 7;
+
+std::mutex IoMutex;
 
 }	// namespace uci
 
@@ -42,22 +43,15 @@ namespace {
 
 const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
-void intro()
+/* The search runs on its own thread, so that the main thread (I/O thread) keeps reading the input
+ * during the search: "stop" and "ponderhit" only set flags that the search polls, and "isready" is
+ * answered at once. Any other command waits for the search to finish (it uses the board). */
+std::thread Searcher;
+
+void wait_search()
 {
-	std::cout << "id name DiscoCheck 5.2\n"
-		<< "id author Lucas Braesch\n"
-		// Declare UCI options here
-		<< "option name Hash type spin default " << uci::Hash << " min 1 max 8192\n"
-		<< "option name Clear Hash type button\n"
-		<< "option name Contempt type spin default " << uci::Contempt << " min 0 max 100\n"
-		<< "option name Ponder type check default " << uci::Ponder << '\n'
-		<< "option name UCI_AnalyseMode type check default " << uci::Analyze << '\n'
-		<< "option name UCI_LimitStrength type check default " << uci::LimitStrength << '\n'
-		<< "option name UCI_Elo type spin default " << uci::Elo
-			<< " min " << uci::ELO_MIN << " max " << uci::ELO_MAX <<  '\n'
-		<< "option name Time Buffer type spin default " << uci::TimeBuffer << " min 0 max 1000\n"
-		// end of UCI options
-		<< "uciok" << std::endl;
+	if (Searcher.joinable())
+		Searcher.join();
 }
 
 void position(board::Board& B, std::istringstream& is)
@@ -87,14 +81,11 @@ void position(board::Board& B, std::istringstream& is)
 void go(board::Board& B, std::istringstream& is)
 {
 	search::Limits sl;
-	search::polling_frequency = 256;
 
-	if (uci::LimitStrength) {
+	if (uci::LimitStrength)
 		// discard parameters of the go command
 		sl.nodes = pow(2.0, 8.0 + pow((uci::Elo - uci::ELO_MIN) / 128.0, 1.0 / 0.9));
-		if (sl.nodes / 16 <= 256)
-			search::polling_frequency = 1ULL << bb::msb(sl.nodes / 16);
-	} else {
+	else {
 		std::string token;
 		while (is >> token) {
 			if (token == (B.get_turn() ? "btime" : "wtime"))
@@ -111,15 +102,24 @@ void go(board::Board& B, std::istringstream& is)
 				is >> sl.nodes;
 			else if (token == "ponder")
 				sl.ponder = true;
+			else if (token == "infinite")
+				sl.infinite = true;
 		}
 	}
 
-	// best and ponder move
-	std::pair<move::move_t, move::move_t> best = bestmove(B, sl);
-	std::cout << "bestmove " << move_to_string(best.first);
-	if (best.second)
-		std::cout << " ponder " << move_to_string(best.second);
-	std::cout << std::endl;
+	// set before starting the search thread, so that a "stop" or "ponderhit" that follows is not lost
+	search::stop_signal = false;
+	search::pondering = sl.ponder;
+
+	Searcher = std::thread([&B, sl]() {
+		// best and ponder move
+		const std::pair<move::move_t, move::move_t> best = search::bestmove(B, sl);
+		std::lock_guard<std::mutex> lock(uci::IoMutex);
+		std::cout << "bestmove " << move_to_string(best.first);
+		if (best.second)
+			std::cout << " ponder " << move_to_string(best.second);
+		std::cout << std::endl;
+	});
 }
 
 void setoption(std::istringstream& is)
@@ -134,8 +134,17 @@ void setoption(std::istringstream& is)
 	/* UCI option 'name' has been modified. Handle here. */
 	if (name == "Hash")
 		is >> uci::Hash;
-	else if (name == "ClearHash")
+	else if (name == "PawnHash") {
+		is >> uci::PawnHash;
+		eval::init_pawn_cache(uint64_t(uci::PawnHash) << 20);
+	} else if (name == "ClearHash")
 		search::clear_state();
+	else if (name == "Threads") {
+		// same range as advertised by intro(): the search needs at least one worker
+		is >> uci::Threads;
+		uci::Threads = std::max(1, std::min(uci::Threads, 64));
+	} else if (name == "NUMAInterleave")
+		is >> uci::NumaInterleave;
 	else if (name == "Contempt")
 		is >> uci::Contempt;
 	else if (name == "Ponder")
@@ -148,49 +157,48 @@ void setoption(std::istringstream& is)
 		is >> uci::Elo;
 	else if (name == "TimeBuffer")
 		is >> uci::TimeBuffer;
-}
-
-bool input_available()
-{
-#if defined(_WIN32) || defined(_WIN64)
-
-	static bool init = false, is_pipe;
-	static HANDLE stdin_h;
-	DWORD val;
-
-	if (!init) {
-		init = true;
-		stdin_h = GetStdHandle(STD_INPUT_HANDLE);
-		is_pipe = !GetConsoleMode(stdin_h, &val);
-	}
-
-	if (stdin->_cnt > 0)
-		return true;
-
-	if (is_pipe)
-		return !PeekNamedPipe(stdin_h, nullptr, 0, nullptr, &val, nullptr) ? true : val > 0;
-	else
-		return _kbhit();
-
-#else   // assume POSIX
-
-	fd_set readfds;
-	FD_ZERO(&readfds);
-	FD_SET(STDIN_FILENO, &readfds);
-
-	struct timeval timeout;
-	timeout.tv_sec = timeout.tv_usec = 0;
-
-	select(STDIN_FILENO + 1, &readfds, 0, 0, &timeout);
-	return FD_ISSET(STDIN_FILENO, &readfds);
-
-#endif
+	else if (name == "SyzygyPath") {
+		// the path may contain spaces
+		std::getline(is >> std::ws, uci::SyzygyPath);
+		const int cnt = syzygy::init(uci::SyzygyPath);
+		std::cout << "info string found " << cnt << " tablebases" << std::endl;
+	} else if (name == "SyzygyProbeDepth")
+		is >> uci::SyzygyProbeDepth;
+	else if (name == "SyzygyProbeLimit")
+		is >> uci::SyzygyProbeLimit;
 }
 
 }	// namespace
 
 namespace uci {
 
+void intro()
+{
+	// boolalpha for the default values of the check options
+	std::cout << std::boolalpha << "id name DiscoCheck 5.2\n"
+		<< "id author Lucas Braesch\n"
+		// Declare UCI options here
+		<< "option name Hash type spin default " << uci::Hash << " min 1 max 1048576\n"
+		<< "option name Pawn Hash type spin default " << uci::PawnHash << " min 1 max 1024\n"
+		<< "option name NUMA Interleave type check default " << uci::NumaInterleave << '\n'
+		<< "option name Clear Hash type button\n"
+		<< "option name Threads type spin default " << uci::Threads << " min 1 max 64\n"
+		<< "option name Contempt type spin default " << uci::Contempt << " min 0 max 100\n"
+		<< "option name Ponder type check default " << uci::Ponder << '\n'
+		<< "option name UCI_AnalyseMode type check default " << uci::Analyze << '\n'
+		<< "option name UCI_LimitStrength type check default " << uci::LimitStrength << '\n'
+		<< "option name UCI_Elo type spin default " << uci::Elo
+			<< " min " << uci::ELO_MIN << " max " << uci::ELO_MAX <<  '\n'
+		<< "option name Time Buffer type spin default " << uci::TimeBuffer << " min 0 max 1000\n"
+		<< "option name SyzygyPath type string default " << uci::SyzygyPath << '\n'
+		<< "option name SyzygyProbeDepth type spin default " << uci::SyzygyProbeDepth
+			<< " min 1 max 100\n"
+		<< "option name SyzygyProbeLimit type spin default " << uci::SyzygyProbeLimit
+			<< " min 0 max 7\n"
+		// end of UCI options
+		<< "uciok" << std::endl;
+}
+
 void loop()
 {
 	board::Board B;
@@ -198,12 +206,30 @@ void loop()
 	std::cout << std::boolalpha;
 
 	while (token != "quit") {
-		if (!getline(std::cin, cmd) || cmd == "quit")
+		if (!getline(std::cin, cmd) || cmd == "quit") {
+			search::stop_signal = true;
 			break;
+		}
 
 		std::istringstream is(cmd);
 		is >> std::boolalpha;
 		is >> std::skipws >> token;
+
+		// commands that are handled during the search
+		if (token == "stop") {
+			search::stop_signal = true;
+			continue;
+		} else if (token == "ponderhit") {
+			search::ponderhit();
+			continue;
+		} else if (token == "isready" && Searcher.joinable()) {
+			std::lock_guard<std::mutex> lock(IoMutex);
+			std::cout << "readyok" << std::endl;
+			continue;
+		}
+
+		wait_search();
+
 		if (token == "uci")
 			intro();
 		else if (token == "ucinewgame")
@@ -213,7 +239,8 @@ void loop()
 		else if (token == "go")
 			go(B, is);
 		else if (token == "isready") {
-			search::TT.alloc(Hash << 20);
+			search::TT.alloc((uint64_t)Hash << 20, NumaInterleave,
+				std::thread::hardware_concurrency());
 			std::cout << "readyok" << std::endl;
 		} else if (token == "setoption")
 			setoption(is);
@@ -221,21 +248,25 @@ void loop()
 			const int e = eval::symmetric_eval(B) + eval::asymmetric_eval(B, hanging_pieces(B));
 			std::cout << B << "eval = " << e << std::endl;
 		} else if (token == "perft") {
-			int depth;
-			if (is >> depth)
-				std::cout << perft(B, depth, 0) << std::endl;
+			// perft <depth> [threads <n>] [hash <mb>]
+			int depth, threads = 1, hash = Hash;
+			if (is >> depth) {
+				std::string opt;
+				while (is >> opt) {
+					if (opt == "threads")
+						is >> threads;
+					else if (opt == "hash")
+						is >> hash;
+				}
+				// same ranges as the Threads and Hash options
+				threads = std::max(1, std::min(threads, 64));
+				hash = std::max(0, std::min(hash, 1048576));
+				std::cout << perft(B, depth, threads, hash, false, true) << std::endl;
+			}
 		}
 	}
-}
-
-std::string check_input()
-{
-	std::string token;
-
-	if (input_available())
-		getline(std::cin, token);
 
-	return token;
+	wait_search();
 }
 
 void info::clear()
@@ -13,20 +13,30 @@
  * see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <mutex>
 #include <string>
 #include "move.h"
 
 namespace uci {
 
 extern void loop();
-extern std::string check_input();
+
+// Answers the "uci" command: engine name, options, and "uciok"
+extern void intro();
+
+// Held to write to std::cout, which both the search thread and the I/O thread do
+extern std::mutex IoMutex;
 
 // UCI option values
 extern int Hash;		// in MB
+extern int PawnHash;	// in MB
+extern int Threads;
 extern int Contempt;	// in cp
-extern bool LimitStrength, Ponder, Analyze;
+extern bool LimitStrength, Ponder, Analyze, NumaInterleave;
 extern int Elo;
 extern int TimeBuffer;
+extern std::string SyzygyPath;
+extern int SyzygyProbeDepth, SyzygyProbeLimit;
 
 struct info {
 	void clear();